@@ -0,0 +1,350 @@
+/*
+ * Persistent BSS table: what is remembered about each BSS across scans.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * Long wardriving runs see hundreds of thousands of BSSes, hence the memory of
+ * the table is bounded by the 'bss_memory' setting. Records have a fixed size
+ * and live in one array, linked by index (+ 1, so that 0 means none) into hash
+ * chains and into a list in order of use. When the table is full, the least
+ * recently seen BSS is evicted to make room. ESSIDs are interned in a pool of
+ * reference-counted strings, since many BSSes share the same few ESSIDs; each
+ * also holds the evil-twin profile of the ESSID (see evil_twin.c).
+ *
+ * The table is only used by the thread that post-processes the scan results
+ * (the scan thread, or the export loop), hence needs no locking.
+ */
+#include "iw_scan.h"
+
+/**
+ * struct essid_slot - an interned ESSID
+ * @refs:    number of records using the ESSID, 0 if the slot is free
+ * @hnext:   index + 1 of the next slot in the same hash bucket, or in the free list
+ * @essid:   the ESSID
+ * @profile: what the BSSes of the ESSID look like
+ */
+struct essid_slot {
+	uint32_t		refs,
+				hnext;
+	char			essid[MAX_ESSID_LEN + 2];
+	struct essid_profile	profile;
+};
+
+/* Memory budgeted per BSS: its record, a hash bucket and (at worst) an ESSID. */
+#define BSS_RECORD_COST	(sizeof(struct bss_record) + sizeof(struct essid_slot) + 2 * sizeof(uint32_t))
+
+/**
+ * struct index_array - a growable array of fixed-size elements
+ * @base:  the elements
+ * @len:   number of elements in use
+ * @alloc: number of elements allocated
+ */
+struct index_array {
+	void		*base;
+	uint32_t	len,
+			alloc;
+};
+
+static struct {
+	struct index_array	recs,		/* &struct bss_record */
+				essids;		/* &struct essid_slot */
+	uint32_t		*buckets,	/* record hash chains */
+				*ebuckets,	/* ESSID hash chains */
+				nbuckets,
+				nebuckets,
+				num_records,
+				num_essids,
+				free_recs,	/* chained via @hnext */
+				free_essids,	/* chained via @hnext */
+				lru_head,	/* most recently used */
+				lru_tail;	/* least recently used */
+} bt;
+
+#define REC(i)		(((struct bss_record *)bt.recs.base) + (i) - 1)
+#define ESSID(i)	(((struct essid_slot *)bt.essids.base) + (i) - 1)
+
+/* Maximum number of records, as set by the 'bss_memory' option. */
+static uint32_t bss_table_capacity(void)
+{
+	return ((size_t)conf.bss_mem << 20) / BSS_RECORD_COST;
+}
+
+/* Append an element of @size to @a, not growing it beyond @max elements. Returns its index + 1. */
+static uint32_t index_array_add(struct index_array *a, size_t size, uint32_t max)
+{
+	if (a->len == a->alloc) {
+		uint32_t n = a->alloc ? 2 * a->alloc : 256;
+
+		if (n > max)
+			n = max;
+		a->base = realloc(a->base, (size_t)n * size);
+		if (!a->base)
+			err_sys("unable to allocate BSS table");
+		a->alloc = n;
+	}
+	memset((char *)a->base + (size_t)a->len * size, 0, size);
+	return ++a->len;
+}
+
+/*
+ * Rebuild the hash chains of @n buckets over the first @count elements. @key_hash
+ * returns false for unused elements, else stores the hash of the element in @h.
+ */
+static uint32_t *rehash(uint32_t *old, uint32_t n, uint32_t count,
+			bool (*key_hash)(uint32_t i, uint32_t *h), uint32_t *(*next)(uint32_t i))
+{
+	uint32_t *buckets = realloc(old, n * sizeof(*buckets));
+
+	if (!buckets)
+		err_sys("unable to allocate BSS table index");
+	memset(buckets, 0, n * sizeof(*buckets));
+
+	for (uint32_t i = 1; i <= count; i++) {
+		uint32_t *b, h;
+
+		if (!key_hash(i, &h))
+			continue;
+		b        = &buckets[h & (n - 1)];
+		*next(i) = *b;
+		*b       = i;
+	}
+	return buckets;
+}
+
+/*
+ * ESSID pool
+ */
+static bool essid_hash(uint32_t i, uint32_t *h)
+{
+	*h = hash_fnv1a(ESSID(i)->essid, strlen(ESSID(i)->essid));
+	return ESSID(i)->refs;
+}
+
+static uint32_t *essid_next(uint32_t i)
+{
+	return &ESSID(i)->hnext;
+}
+
+/* Return the slot of @essid with an added reference, interning it if new. */
+static uint32_t essid_intern(const char *essid, uint32_t max)
+{
+	const uint32_t h = hash_fnv1a(essid, strlen(essid));
+	uint32_t i;
+
+	if (bt.nebuckets)
+		for (i = bt.ebuckets[h & (bt.nebuckets - 1)]; i; i = ESSID(i)->hnext)
+			if (!strcmp(ESSID(i)->essid, essid)) {
+				ESSID(i)->refs++;
+				return i;
+			}
+
+	if (bt.free_essids) {
+		i              = bt.free_essids;
+		bt.free_essids = ESSID(i)->hnext;
+		memset(ESSID(i), 0, sizeof(struct essid_slot));
+	} else {
+		i = index_array_add(&bt.essids, sizeof(struct essid_slot), max);
+	}
+	snprintf(ESSID(i)->essid, sizeof(ESSID(i)->essid), "%s", essid);
+	ESSID(i)->refs = 1;
+	bt.num_essids++;
+
+	/* Keep the load factor at or below 1; free slots are not in any chain. */
+	if (bt.num_essids > bt.nebuckets) {
+		bt.nebuckets = bt.nebuckets ? 2 * bt.nebuckets : 256;
+		bt.ebuckets  = rehash(bt.ebuckets, bt.nebuckets, bt.essids.len, essid_hash, essid_next);
+	} else {
+		ESSID(i)->hnext = bt.ebuckets[h & (bt.nebuckets - 1)];
+		bt.ebuckets[h & (bt.nebuckets - 1)] = i;
+	}
+	return i;
+}
+
+/* Drop a reference to ESSID slot @i, freeing the slot when unused. */
+static void essid_release(uint32_t i)
+{
+	uint32_t *p;
+
+	if (!i || --ESSID(i)->refs)
+		return;
+
+	p = &bt.ebuckets[hash_fnv1a(ESSID(i)->essid, strlen(ESSID(i)->essid)) & (bt.nebuckets - 1)];
+	while (*p != i)
+		p = &ESSID(*p)->hnext;
+	*p = ESSID(i)->hnext;
+
+	ESSID(i)->hnext = bt.free_essids;
+	bt.free_essids  = i;
+	bt.num_essids--;
+}
+
+/*
+ * Records
+ */
+static uint32_t *bss_bucket(const struct ether_addr *addr)
+{
+	return &bt.buckets[hash_fnv1a(addr, sizeof(*addr)) & (bt.nbuckets - 1)];
+}
+
+static bool bss_hash(uint32_t i, uint32_t *h)
+{
+	*h = hash_fnv1a(&REC(i)->addr, sizeof(REC(i)->addr));
+	/* Only records in use are on the LRU list. */
+	return REC(i)->lru_prev || bt.lru_head == i;
+}
+
+static uint32_t *bss_next(uint32_t i)
+{
+	return &REC(i)->hnext;
+}
+
+static void lru_unlink(uint32_t i)
+{
+	struct bss_record *rec = REC(i);
+
+	if (rec->lru_prev)
+		REC(rec->lru_prev)->lru_next = rec->lru_next;
+	else
+		bt.lru_head = rec->lru_next;
+	if (rec->lru_next)
+		REC(rec->lru_next)->lru_prev = rec->lru_prev;
+	else
+		bt.lru_tail = rec->lru_prev;
+	rec->lru_prev = rec->lru_next = 0;
+}
+
+static void lru_push(uint32_t i)
+{
+	REC(i)->lru_prev = 0;
+	REC(i)->lru_next = bt.lru_head;
+	if (bt.lru_head)
+		REC(bt.lru_head)->lru_prev = i;
+	else
+		bt.lru_tail = i;
+	bt.lru_head = i;
+}
+
+/* Forget the least recently used record, moving it to the free list. */
+static void bss_evict(void)
+{
+	const uint32_t i = bt.lru_tail;
+	uint32_t *p = bss_bucket(&REC(i)->addr);
+
+	while (*p != i)
+		p = &REC(*p)->hnext;
+	*p = REC(i)->hnext;
+
+	lru_unlink(i);
+	essid_release(REC(i)->essid);
+	memset(REC(i), 0, sizeof(struct bss_record));
+	REC(i)->hnext = bt.free_recs;
+	bt.free_recs  = i;
+	bt.num_records--;
+}
+
+/* Return the index + 1 of the record of @addr, or 0 if it is not in the table. */
+static uint32_t bss_lookup(const struct ether_addr *addr)
+{
+	uint32_t i;
+
+	if (!bt.nbuckets)
+		return 0;
+	for (i = *bss_bucket(addr); i; i = REC(i)->hnext)
+		if (!memcmp(&REC(i)->addr, addr, sizeof(*addr)))
+			break;
+	if (i && bt.lru_head != i) {
+		lru_unlink(i);
+		lru_push(i);
+	}
+	return i;
+}
+
+/**
+ * Return the record of @addr, or NULL if it is not in the table. Like the
+ * result of bss_table_get(), the pointer is only valid until the next call
+ * of bss_table_get(), which may evict or move records.
+ */
+struct bss_record *bss_table_find(const struct ether_addr *addr)
+{
+	const uint32_t i = bss_lookup(addr);
+
+	return i ? REC(i) : NULL;
+}
+
+/** Return the record of @addr, adding a blank one (maybe evicting the least recently seen) if new. */
+struct bss_record *bss_table_get(const struct ether_addr *addr)
+{
+	const uint32_t max = bss_table_capacity();
+	uint32_t i = bss_lookup(addr), *b;
+
+	if (i)
+		return REC(i);
+
+	/* The limit may have been lowered since the table was filled. */
+	while (bt.num_records >= max)
+		bss_evict();
+
+	if (bt.free_recs) {
+		i            = bt.free_recs;
+		bt.free_recs = REC(i)->hnext;
+		REC(i)->hnext = 0;
+	} else {
+		i = index_array_add(&bt.recs, sizeof(struct bss_record), max);
+	}
+	REC(i)->addr = *addr;
+	lru_push(i);
+	bt.num_records++;
+
+	/* Keep the load factor at or below 1. */
+	if (bt.num_records > bt.nbuckets) {
+		bt.nbuckets = bt.nbuckets ? 2 * bt.nbuckets : 256;
+		bt.buckets  = rehash(bt.buckets, bt.nbuckets, bt.recs.len, bss_hash, bss_next);
+	} else {
+		b             = bss_bucket(addr);
+		REC(i)->hnext = *b;
+		*b            = i;
+	}
+	return REC(i);
+}
+
+/* Set the ESSID of @rec to @essid. */
+static void bss_set_essid(struct bss_record *rec, const char *essid)
+{
+	if (!rec->essid || strcmp(ESSID(rec->essid)->essid, essid)) {
+		/* Release first: the pool has no more slots than the table has records. */
+		essid_release(rec->essid);
+		rec->essid = essid_intern(essid, bss_table_capacity());
+	}
+}
+
+/**
+ * Remember the ESSID of @e if it has one, else fill it in from an earlier scan.
+ * Returns true if the ESSID of @e has been filled in.
+ */
+bool bss_resolve_essid(struct scan_entry *e)
+{
+	struct bss_record *rec;
+
+	if (*e->essid) {
+		bss_set_essid(bss_table_get(&e->ap_addr), e->essid);
+		return false;
+	}
+
+	rec = bss_table_find(&e->ap_addr);
+	if (!rec || !rec->essid)
+		return false;
+
+	snprintf(e->essid, sizeof(e->essid), "%s", ESSID(rec->essid)->essid);
+	e->essid_hidden = true;
+	e->essid_cached = true;
+	return true;
+}
+
+/**
+ * Return the profile of @essid, setting it as the ESSID of @rec. A new profile is
+ * blank. The pointer is only valid until the next ESSID is interned.
+ */
+struct essid_profile *bss_essid_profile(struct bss_record *rec, const char *essid)
+{
+	bss_set_essid(rec, essid);
+	return &ESSID(rec->essid)->profile;
+}
@@ -0,0 +1,167 @@
+/*
+ * Channel-occupancy history: per-channel time series of the scan results.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * The history is a fixed-size ring of one-minute slots, covering the last day.
+ * Each scan is appended to the slot of the current minute, which keeps the peak
+ * values of all scans within that minute. Storage is columnar: every metric is
+ * an array per channel, so that plotting one channel reads consecutive memory.
+ * A slot is valid only if its minute stamp matches, so that minutes without a
+ * scan (e.g. while another screen is shown) need no special treatment.
+ *
+ * Appended to by the scan thread, read by the UI.
+ */
+#include "iw_scan.h"
+
+/* Maximum number of 20 MHz channels (compare compute_chan_occupancy()). */
+#define CHAN_HIST_MAX_CHANS	128
+
+const char *const chan_hist_names[CH_NUM_METRICS] = {
+	[CH_APS]  = "access points",
+	[CH_UTIL] = "weighted utilisation",
+	[CH_LOAD] = "max BSS load (%)",
+};
+
+/**
+ * struct chan_history - columnar ring of per-channel samples
+ * @minute:    minute (since the epoch) of each slot, 0 if the slot is unused
+ * @freq:      centre frequency of each channel column, in order of appearance
+ * @num_chans: number of channel columns in use
+ * @count:     number of BSSes overlapping the channel
+ * @util:      occupancy score of the channel, in 1/100
+ * @load:      highest channel utilisation in a BSS load element (0..255)
+ * @generation: incremented on every append
+ */
+static struct chan_history {
+	uint32_t	minute[CHAN_HIST_SLOTS];
+	uint16_t	freq[CHAN_HIST_MAX_CHANS];
+	size_t		num_chans;
+	uint8_t		count[CHAN_HIST_MAX_CHANS][CHAN_HIST_SLOTS];
+	uint16_t	util[CHAN_HIST_MAX_CHANS][CHAN_HIST_SLOTS];
+	uint8_t		load[CHAN_HIST_MAX_CHANS][CHAN_HIST_SLOTS];
+	uint32_t	generation;
+} ch;
+static pthread_mutex_t ch_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Return the column of @freq, adding one if new (-1 if there is no room). */
+static int chan_column(uint16_t freq)
+{
+	size_t c;
+
+	for (c = 0; c < ch.num_chans; c++)
+		if (ch.freq[c] == freq)
+			return c;
+	if (c == CHAN_HIST_MAX_CHANS)
+		return -1;
+	ch.freq[ch.num_chans++] = freq;
+	return c;
+}
+
+/** Append the channel occupancy of @sr to the slot of the current minute. */
+void chan_hist_append(const struct scan_result *sr)
+{
+	const uint32_t minute = time(NULL) / CHAN_HIST_SLOT_SEC, slot = minute % CHAN_HIST_SLOTS;
+
+	pthread_mutex_lock(&ch_mutex);
+	if (ch.minute[slot] != minute) {
+		for (size_t c = 0; c < ch.num_chans; c++) {
+			ch.count[c][slot] = 0;
+			ch.util[c][slot]  = 0;
+			ch.load[c][slot]  = 0;
+		}
+		ch.minute[slot] = minute;
+	}
+
+	for (size_t i = 0; i < sr->num.occupancy; i++) {
+		const struct chan_occupancy *occ = sr->occupancy + i;
+		const uint32_t util = occ->score * 100 + 0.5;
+		int c = chan_column(occ->freq);
+
+		if (c < 0)
+			continue;
+		if (occ->count > ch.count[c][slot])
+			ch.count[c][slot] = occ->count > UINT8_MAX ? UINT8_MAX : occ->count;
+		if (util > ch.util[c][slot])
+			ch.util[c][slot] = util > UINT16_MAX ? UINT16_MAX : util;
+		if (occ->max_load > ch.load[c][slot])
+			ch.load[c][slot] = occ->max_load;
+	}
+	ch.generation++;
+	pthread_mutex_unlock(&ch_mutex);
+}
+
+/** Number of appends so far, to tell whether the history has changed. */
+uint32_t chan_hist_generation(void)
+{
+	uint32_t gen;
+
+	pthread_mutex_lock(&ch_mutex);
+	gen = ch.generation;
+	pthread_mutex_unlock(&ch_mutex);
+	return gen;
+}
+
+static int cmp_u16(const void *a, const void *b)
+{
+	return *(const uint16_t *)a - *(const uint16_t *)b;
+}
+
+/** Store up to @max channels (centre frequencies) of the history in @freqs, sorted. */
+size_t chan_hist_channels(uint16_t freqs[], size_t max)
+{
+	size_t n;
+
+	pthread_mutex_lock(&ch_mutex);
+	n = ch.num_chans < max ? ch.num_chans : max;
+	memcpy(freqs, ch.freq, n * sizeof(*freqs));
+	pthread_mutex_unlock(&ch_mutex);
+
+	qsort(freqs, n, sizeof(*freqs), cmp_u16);
+	return n;
+}
+
+static float slot_value(int c, uint32_t slot, enum chan_hist_metric m)
+{
+	switch (m) {
+	case CH_APS:
+		return ch.count[c][slot];
+	case CH_UTIL:
+		return ch.util[c][slot] / 1e2;
+	default:
+		return ch.load[c][slot] * 1e2 / 255;
+	}
+}
+
+/**
+ * Fill @out with the peak of @m on channel @freq over @n consecutive spans of
+ * @step minutes, the last of which ends with the current minute. Spans without
+ * any scan are set to -1. Returns the largest value in @out.
+ */
+float chan_hist_series(uint16_t freq, enum chan_hist_metric m, int step, float out[], int n)
+{
+	const uint32_t now = time(NULL) / CHAN_HIST_SLOT_SEC;
+	float peak = -1;
+	int c;
+
+	for (int i = 0; i < n; i++)
+		out[i] = -1;
+
+	pthread_mutex_lock(&ch_mutex);
+	for (c = 0; c < (int)ch.num_chans && ch.freq[c] != freq; c++)
+		;
+	for (int i = 0; c < (int)ch.num_chans && i < n; i++) {
+		for (int k = 0; k < step; k++) {
+			const uint32_t age = (n - 1 - i) * step + k, minute = now - age,
+				       slot = minute % CHAN_HIST_SLOTS;
+
+			if (age >= CHAN_HIST_SLOTS || ch.minute[slot] != minute)
+				continue;
+			if (slot_value(c, slot, m) > out[i])
+				out[i] = slot_value(c, slot, m);
+		}
+		if (out[i] > peak)
+			peak = out[i];
+	}
+	pthread_mutex_unlock(&ch_mutex);
+	return peak;
+}
@@ -0,0 +1,209 @@
+/*
+ * Channel-plan recommender, based on scan results and channel survey data.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "iw_scan.h"
+#include "iw_nl80211.h"
+
+/* Weight of a fully busy subchannel (survey), in units of the occupancy score. */
+#define SURVEY_BUSY_WEIGHT	2.0
+/* Penalties for channels that require radar detection / may not initiate radiation. */
+#define DFS_PENALTY		0.25
+#define NO_IR_PENALTY		0.5
+
+/*
+ * Candidate centre channels of the 5 GHz band, per channel width.
+ * 6 GHz channels follow a regular raster and are computed instead.
+ */
+static const uint8_t chans_5g_20[] = {
+	36, 40, 44, 48, 52, 56, 60, 64, 100, 104, 108, 112, 116, 120, 124, 128,
+	132, 136, 140, 144, 149, 153, 157, 161, 165, 169, 173, 177
+};
+static const uint8_t chans_5g_40[]  = { 38, 46, 54, 62, 102, 110, 118, 126, 134, 142, 151, 159, 167, 175 };
+static const uint8_t chans_5g_80[]  = { 42, 58, 106, 122, 138, 155, 171 };
+static const uint8_t chans_5g_160[] = { 50, 114, 163 };
+
+/**
+ * struct plan_input - per-scan data that candidate channels are evaluated against
+ * @sr:     scan results (for the per-channel occupancy)
+ * @survey: channel survey data (may be empty, or only cover some channels)
+ * @reg:    regulatory rules (may be empty)
+ * @freqs:  enabled channels of the radio (may be empty)
+ */
+struct plan_input {
+	const struct scan_result		*sr;
+	const struct iw_nl80211_survey_dump	*survey;
+	const struct iw_nl80211_reg		*reg;
+	const struct iw_nl80211_freqs		*freqs;
+};
+
+/* Whether the radio supports the 20 MHz channel at @freq (if its channels are known). */
+static bool chan_supported(const struct iw_nl80211_freqs *fl, uint32_t freq)
+{
+	for (size_t i = 0; i < fl->num; i++)
+		if (fl->freq[i] == freq)
+			return true;
+	return !fl->num;
+}
+
+/* Survey data of @freq, or NULL if the driver reports none for this channel. */
+static const struct iw_nl80211_survey *survey_of(const struct iw_nl80211_survey_dump *sd,
+						 uint32_t freq)
+{
+	for (size_t i = 0; i < sd->num; i++)
+		if (sd->chans[i].freq == freq)
+			return sd->chans + i;
+	return NULL;
+}
+
+/*
+ * Return true if the regulatory rules permit a @width MHz channel that includes
+ * the 20 MHz subchannel at @freq. Adds the DFS/NO_IR restrictions to @flags.
+ */
+static bool reg_permits(const struct iw_nl80211_reg *reg, int freq, int width, uint8_t *flags)
+{
+	if (!reg->num_rules)		/* no regulatory information */
+		return true;
+
+	for (int i = 0; i < reg->num_rules; i++) {
+		const struct iw_nl80211_reg_rule *rule = reg->rules + i;
+
+		if (freq - 10 < (int)rule->start || freq + 10 > (int)rule->end)
+			continue;
+		if ((rule->max_bw && width > (int)rule->max_bw && !(rule->flags & NL80211_RRF_AUTO_BW)) ||
+		    (width >= 80  && (rule->flags & NL80211_RRF_NO_80MHZ)) ||
+		    (width >= 160 && (rule->flags & NL80211_RRF_NO_160MHZ)))
+			return false;
+		if (rule->flags & NL80211_RRF_DFS)
+			*flags |= CP_DFS;
+		if (rule->flags & NL80211_RRF_NO_IR)
+			*flags |= CP_NO_IR;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Evaluate the @width MHz channel centred at @freq_ctr into @cand.
+ * A wide channel is limited by its busiest 20 MHz subchannel; the others add
+ * a quarter of their cost. Returns false if the channel can not be used.
+ */
+static bool eval_candidate(const struct plan_input *in, int freq_ctr, int width,
+			   struct chan_candidate *cand)
+{
+	const int lo = freq_ctr - width / 2;
+	float worst = 0, sum = 0;
+	int f;
+
+	memset(cand, 0, sizeof(*cand));
+	for (f = lo + 10; f < lo + width; f += 20) {
+		const struct iw_nl80211_survey *sd = survey_of(in->survey, f);
+		float cost = chan_occupancy_score(in->sr, f), busy = 0;
+
+		if (!chan_supported(in->freqs, f))
+			return false;
+		if (!reg_permits(in->reg, f, width, &cand->flags))
+			return false;
+
+		/* Many drivers only survey the channel in use: the others are not busy as far as known. */
+		if (sd && sd->time.active && sd->time.busy <= sd->time.active)
+			busy = (float)sd->time.busy / sd->time.active;
+		if (busy > cand->busy)
+			cand->busy = busy;
+
+		cost += SURVEY_BUSY_WEIGHT * busy;
+		if (cost > worst)
+			worst = cost;
+		sum += cost;
+	}
+
+	cand->freq_ctr = freq_ctr;
+	cand->width    = width;
+	cand->cost     = worst + (sum - worst) / 4;
+	if (cand->flags & CP_DFS)
+		cand->cost += DFS_PENALTY;
+	if (cand->flags & CP_NO_IR)
+		cand->cost += NO_IR_PENALTY;
+	return true;
+}
+
+static void add_candidate(struct scan_result *sr, size_t *max_n, const struct plan_input *in,
+			  int freq_ctr, int width)
+{
+	struct chan_candidate cand;
+
+	if (!eval_candidate(in, freq_ctr, width, &cand))
+		return;
+	if (sr->num.plan == *max_n) {
+		*max_n = *max_n ? 2 * *max_n : 64;
+		sr->plan = realloc(sr->plan, *max_n * sizeof(*sr->plan));
+		if (!sr->plan)
+			err_sys("unable to allocate channel plan");
+	}
+	sr->plan[sr->num.plan++] = cand;
+}
+
+static void add_5g_candidates(struct scan_result *sr, size_t *max_n, const struct plan_input *in,
+			      const uint8_t *chans, size_t num_chans, int width)
+{
+	for (size_t i = 0; i < num_chans; i++)
+		add_candidate(sr, max_n, in, 5000 + 5 * chans[i], width);
+}
+
+/* Lowest cost first; prefer the wider channel at equal cost. */
+static int cmp_cost(const void *a, const void *b)
+{
+	const struct chan_candidate *ca = a, *cb = b;
+
+	if (ca->cost != cb->cost)
+		return ca->cost < cb->cost ? -1 : 1;
+	return cb->width - ca->width;
+}
+
+/**
+ * Fill in sr->plan (must not have been allocated yet) with all usable channels
+ * and widths, ranked by cost. Needs the per-channel occupancy of @sr, so that
+ * the cost of evaluating the candidates does not depend on the number of BSSes.
+ * 2.4 GHz candidates are limited to 20 MHz, as 40 MHz leaves no room there.
+ */
+void compute_chan_plan(struct scan_result *sr)
+{
+	struct iw_nl80211_survey_dump survey;
+	struct iw_nl80211_reg reg;
+	struct iw_nl80211_freqs freqs;
+	struct plan_input in = { .sr = sr, .survey = &survey, .reg = &reg, .freqs = &freqs };
+	bool have_5g = true, have_6g = true;
+	size_t max_n = 0;
+	int ch, width;
+
+	iw_nl80211_get_survey_dump(&survey);
+	iw_nl80211_scan_getreg(&reg);
+	iw_nl80211_get_freqs(&freqs);
+	memcpy(sr->plan_country, reg.country, sizeof(sr->plan_country));
+
+	/* Without the channel list, the supported bands are guessed from the scan results. */
+	if (!freqs.num) {
+		have_5g = sr->num.five_gig > 0;
+		have_6g = sr->num.occupancy && sr->occupancy[sr->num.occupancy - 1].freq >= 5950;
+	}
+
+	for (ch = 1; ch <= 13; ch++)
+		add_candidate(sr, &max_n, &in, 2407 + 5 * ch, 20);
+
+	if (have_5g) {
+		add_5g_candidates(sr, &max_n, &in, chans_5g_20, ARRAY_SIZE(chans_5g_20), 20);
+		add_5g_candidates(sr, &max_n, &in, chans_5g_40, ARRAY_SIZE(chans_5g_40), 40);
+		add_5g_candidates(sr, &max_n, &in, chans_5g_80, ARRAY_SIZE(chans_5g_80), 80);
+		add_5g_candidates(sr, &max_n, &in, chans_5g_160, ARRAY_SIZE(chans_5g_160), 160);
+	}
+
+	/* 6 GHz: 20 MHz channels 1, 5, 9, ..., wider channels centred at 3, 7, 15 + n * width/5. */
+	for (width = 20; have_6g && width <= 160; width *= 2)
+		for (ch = width / 10 - 1; ch <= 233; ch += width / 5)
+			add_candidate(sr, &max_n, &in, 5950 + 5 * ch, width);
+
+	free(survey.chans);
+
+	if (sr->num.plan)
+		qsort(sr->plan, sr->num.plan, sizeof(*sr->plan), cmp_cost);
+}
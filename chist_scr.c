@@ -0,0 +1,219 @@
+/*
+ * Channel-history screen: how crowded each channel has been over the last day.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "iw_scan.h"
+
+/* Width of the channel labels on the left. */
+#define CHIST_LABEL_LEN	8
+
+/* Number of columns of the plot. */
+#define CHIST_COLS	(MAXXLEN - CHIST_LABEL_LEN)
+
+/* Maximum number of channels listed (one per line). */
+#define CHIST_MAX_ROWS	128
+
+/* GLOBALS */
+static struct scan_result *sr;		/* only used for its messages */
+static WINDOW *w_chist;
+
+static enum chan_hist_metric metric = CH_APS;
+static bool redraw;
+
+/* Minutes per column, selected with '+' and '-'. */
+static const int zoom_steps[] = { 1, 2, 5, 10, 20 };
+static int zoom;
+
+/* Colour thresholds per metric: green below the first, red from the second. */
+static const int8_t metric_scale[CH_NUM_METRICS][2] = {
+	[CH_APS]  = { 3, 6 },
+	[CH_UTIL] = { 1, 2 },
+	[CH_LOAD] = { 30, 60 },
+};
+
+/* One plot line: a channel and its series. */
+struct chist_row {
+	uint16_t	freq;
+	float		peak;
+	float		*v;
+};
+
+static int cmp_row_peak(const void *a, const void *b)
+{
+	const struct chist_row *ra = a, *rb = b;
+
+	return (rb->peak > ra->peak) - (rb->peak < ra->peak);
+}
+
+static int cmp_row_freq(const void *a, const void *b)
+{
+	return ((const struct chist_row *)a)->freq - ((const struct chist_row *)b)->freq;
+}
+
+/* Character of a cell with value @v, relative to the colour scale of the metric. */
+static chtype chist_cell(float v)
+{
+	const int8_t *cscale = metric_scale[metric];
+	int level;
+
+	if (v < 0)
+		return ' ';
+	if (v == 0)
+		return '.' | COLOR_PAIR(CP_BLUE);
+	/* 1..9, where the red threshold maps to 6. */
+	level = clamp(ceil(v * 6 / cscale[1]), 1, 9);
+	return ('0' + level) | A_BOLD | cp_from_scale(v, cscale, false);
+}
+
+/* Label the time axis at the bottom, every 10 columns. */
+static void display_time_axis(int line)
+{
+	const int step = zoom_steps[zoom];
+	char s[16];
+
+	mvwclrtoborder(w_chist, line, 1);
+	for (int i = 10; i < CHIST_COLS; i += 10) {
+		const int minutes = i * step;
+		const int x = 1 + CHIST_LABEL_LEN + CHIST_COLS - 1 - i;
+		int len;
+
+		if (minutes % 60)
+			len = sprintf(s, "|-%dm", minutes);
+		else
+			len = sprintf(s, "|-%dh", minutes / 60);
+		if (x + len <= MAXXLEN)
+			mvwaddstr(w_chist, line, x, s);
+	}
+	mvwaddstr(w_chist, line, MAXXLEN - 3, "now|");
+}
+
+static void display_chist(void)
+{
+	const int step = zoom_steps[zoom], max_rows = MAXYLEN - 2;
+	uint16_t freqs[CHIST_MAX_ROWS];
+	struct chist_row rows[CHIST_MAX_ROWS];
+	size_t n, num_rows = 0;
+	char s[128];
+	int line = 1;
+
+	n = chan_hist_channels(freqs, CHIST_MAX_ROWS);
+	for (size_t i = 0; i < n; i++) {
+		if ((conf.scan_filter_band == SCAN_FILTER_BAND_2G && freqs[i] >= 2500) ||
+		    (conf.scan_filter_band == SCAN_FILTER_BAND_5G && freqs[i] < 2500))
+			continue;
+		rows[num_rows].freq = freqs[i];
+		rows[num_rows].v    = calloc(CHIST_COLS, sizeof(float));
+		if (!rows[num_rows].v)
+			err_sys("unable to allocate channel history");
+		rows[num_rows].peak = chan_hist_series(freqs[i], metric, step, rows[num_rows].v, CHIST_COLS);
+		num_rows++;
+	}
+
+	wmove(w_chist, line, 1);
+	wclrtoborder(w_chist);
+	wadd_attr_str(w_chist, A_REVERSE, "channel history:");
+	sprintf(s, " peak %s, %d min per column", chan_hist_names[metric], step);
+	waddstr(w_chist, s);
+	if ((int)num_rows > max_rows) {
+		sprintf(s, ", %zu busiest of %zu channels", (size_t)max_rows, num_rows);
+		waddstr(w_chist, s);
+	}
+	line++;
+
+	/* Keep the busiest channels if there is not enough room, shown in order of frequency. */
+	if ((int)num_rows > max_rows) {
+		qsort(rows, num_rows, sizeof(*rows), cmp_row_peak);
+		for (size_t i = max_rows; i < num_rows; i++)
+			free(rows[i].v);
+		num_rows = max_rows;
+		qsort(rows, num_rows, sizeof(*rows), cmp_row_freq);
+	}
+
+	for (size_t i = 0; i < num_rows; i++, line++) {
+		wmove(w_chist, line, 1);
+		sprintf(s, "%s %3d ", rows[i].freq < 2500 ? "ch" : "CH",
+			ieee80211_frequency_to_channel(rows[i].freq));
+		wadd_attr_str(w_chist, A_BOLD, s);
+		for (int x = 0; x < CHIST_COLS; x++)
+			waddch(w_chist, chist_cell(rows[i].v[x]));
+		free(rows[i].v);
+	}
+
+	for (; line < MAXYLEN; line++)
+		mvwclrtoborder(w_chist, line, 1);
+
+	if (!num_rows) {
+		pthread_mutex_lock(&sr->mutex);
+		waddstr_center(w_chist, WAV_HEIGHT/2 - 1, *sr->msg ? sr->msg : "Waiting for scan data ...");
+		pthread_mutex_unlock(&sr->mutex);
+	}
+	display_time_axis(MAXYLEN);
+	wrefresh(w_chist);
+}
+
+void scr_chist_init(void)
+{
+	w_chist = newwin_title(0, WAV_HEIGHT, "Channel history", false);
+	mvwaddstr(w_chist, 2, 1, "Waiting for scan data ...");
+	wrefresh(w_chist);
+
+	redraw = true;
+	/* The history is only appended to while scanning. */
+	sr = scan_service_start();
+}
+
+int scr_chist_loop(WINDOW *w_menu)
+{
+	static uint32_t generation;
+	static time_t last;
+	sigset_t blockmask, oldmask;
+	int key;
+
+	/* Redraw on new data, and at least once per minute for the time axis to move. */
+	if (redraw || generation != chan_hist_generation() || time(NULL) - last >= CHAN_HIST_SLOT_SEC) {
+		generation = chan_hist_generation();
+		last       = time(NULL);
+		redraw     = false;
+
+		/* Do not let a SIGWINCH interrupt while holding the locks. */
+		sigemptyset(&blockmask);
+		sigaddset(&blockmask, SIGWINCH);
+		pthread_sigmask(SIG_BLOCK, &blockmask, &oldmask);
+		display_chist();
+		pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+	}
+
+	key = wgetch(w_menu);
+	switch (key) {
+	case 'm':	/* Next metric */
+		metric = (metric + 1) % CH_NUM_METRICS;
+		break;
+	case '+':	/* Zoom in */
+		if (zoom > 0)
+			zoom--;
+		break;
+	case '-':	/* Zoom out */
+		if (zoom < (int)ARRAY_SIZE(zoom_steps) - 1)
+			zoom++;
+		break;
+	case 'b':	/* Both bands */
+		conf.scan_filter_band = SCAN_FILTER_BAND_BOTH;
+		break;
+	case '2':	/* 2.4 GHz band only */
+		conf.scan_filter_band = SCAN_FILTER_BAND_2G;
+		break;
+	case '5':	/* 5 GHz band only */
+		conf.scan_filter_band = SCAN_FILTER_BAND_5G;
+		break;
+	default:
+		return key;
+	}
+	redraw = true;
+	return -1;
+}
+
+void scr_chist_fini(void)
+{
+	scan_service_pause();
+	delwin(w_chist);
+}
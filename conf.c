@@ -17,8 +17,9 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
-#include "iw_if.h"
+#include "iw_scan.h"
 #include <pwd.h>
+#include <getopt.h>
 #include <netlink/version.h>
 #include <sys/stat.h>
 
@@ -46,10 +47,17 @@ static char *scan_filter_bands[] = {
 	NULL
 };
 
+static char *scan_radio_names[] = {
+	[SCAN_RADIOS_CURRENT]	= "Current",
+	[SCAN_RADIOS_ALL]	= "All",
+	NULL
+};
+
 static char *screen_names[] = {
 	[SCR_INFO]	= "Info screen",
 	[SCR_LHIST]	= "Level history",
 	[SCR_SCAN]	= "Scan window",
+	[SCR_CHIST]	= "Channel history",
 	NULL
 };
 
@@ -72,7 +80,13 @@ struct wavemon_conf conf = {
 	.scan_sort_order	= SO_CHAN_SIG,
 	.scan_sort_asc		= false,
 	.scan_hidden_essids	= true,
+	.scan_progressive	= true,
 	.scan_filter_band	= SCAN_FILTER_BAND_BOTH,
+	.scan_radios		= SCAN_RADIOS_CURRENT,
+	.bss_mem		= 16,
+	.seen_miss		= 1,
+	.scan_defer		= 0,
+	.scan_bg_iv		= 0,
 
 	.startup_scr		= 0,
 };
@@ -159,13 +173,13 @@ static void ensure_is_directory(const char *dirpath)
 }
 
 /**
- * get_config_path - Return full path of wavemon runtime configuration file.
+ * conf_file_path - Return full path of the wavemon file @name.
  * This is one of
- * - $XDG_CONFIG_HOME/wavemon/wavemonrc, or
- * -    $HOME/.config/wavemon/wavemonrc (fallback).
+ * - $XDG_CONFIG_HOME/wavemon/@name, or
+ * -    $HOME/.config/wavemon/@name (fallback).
  * Returns allocated string, which caller needs to de-allocate.
  */
-static char *get_config_path(void)
+char *conf_file_path(const char *name)
 {
 	char *xdg_config_env = getenv("XDG_CONFIG_HOME"),
 	     *xdg_config_home = NULL,
@@ -187,12 +201,18 @@ static char *get_config_path(void)
 	ensure_is_directory(config_dir);
 	free(xdg_config_home);
 
-	config_path = a_sprintf("%s/%src", config_dir, PACKAGE_NAME);
+	config_path = a_sprintf("%s/%s", config_dir, name);
 	free(config_dir);
 
 	return config_path;
 }
 
+/** Return full path of wavemon runtime configuration file, see conf_file_path(). */
+static char *get_config_path(void)
+{
+	return conf_file_path(PACKAGE_NAME "rc");
+}
+
 static void write_cf(void)
 {
 	char tmp[0x100], rv[0x40];
@@ -437,6 +457,14 @@ static void init_conf_items(void)
 	item->list	= scan_filter_bands;
 	ll_push(conf_items, "*", item);
 
+	item = calloc(1, sizeof(*item));
+	item->name	= strdup("Scan radios");
+	item->cfname	= strdup("scan_radios");
+	item->type	= t_list;
+	item->v.i	= &conf.scan_radios;
+	item->list	= scan_radio_names;
+	ll_push(conf_items, "*", item);
+
 	item = calloc(1, sizeof(*item));
 	item->name	= strdup("Scan hidden ESSIDs");
 	item->cfname	= strdup("scan_hidden_essids");
@@ -445,6 +473,58 @@ static void init_conf_items(void)
 	item->list	= on_off_names;
 	ll_push(conf_items, "*", item);
 
+	item = calloc(1, sizeof(*item));
+	item->name	= strdup("Progressive scan");
+	item->cfname	= strdup("scan_progressive");
+	item->type	= t_list;
+	item->v.i	= &conf.scan_progressive;
+	item->list	= on_off_names;
+	ll_push(conf_items, "*", item);
+
+	item = calloc(1, sizeof(*item));
+	item->name	= strdup("BSS memory limit");
+	item->cfname	= strdup("bss_memory");
+	item->type	= t_int;
+	item->v.i	= &conf.bss_mem;
+	item->min	= 1;
+	item->max	= 1024;
+	item->inc	= 1;
+	item->unit	= strdup("MB");
+	ll_push(conf_items, "*", item);
+
+	item = calloc(1, sizeof(*item));
+	item->name	= strdup("New-BSSID miss rate");
+	item->cfname	= strdup("new_bss_miss_rate");
+	item->type	= t_int;
+	item->v.i	= &conf.seen_miss;
+	item->min	= 1;
+	item->max	= 100;
+	item->inc	= 1;
+	item->unit	= strdup("/1000");
+	ll_push(conf_items, "*", item);
+
+	item = calloc(1, sizeof(*item));
+	item->name	= strdup("Defer scans above");
+	item->cfname	= strdup("scan_defer_threshold");
+	item->type	= t_int;
+	item->v.i	= &conf.scan_defer;
+	item->min	= 0;
+	item->max	= 100000;
+	item->inc	= 100;
+	item->unit	= strdup("kbit/s");
+	ll_push(conf_items, "*", item);
+
+	item = calloc(1, sizeof(*item));
+	item->name	= strdup("Background scans every");
+	item->cfname	= strdup("background_scan_interval");
+	item->type	= t_int;
+	item->v.i	= &conf.scan_bg_iv;
+	item->min	= 0;
+	item->max	= 3600;
+	item->inc	= 10;
+	item->unit	= strdup("s");
+	ll_push(conf_items, "*", item);
+
 	item = calloc(1, sizeof(*item));
 	item->type = t_sep;
 	ll_push(conf_items, "*", item);
@@ -583,11 +663,32 @@ static void init_conf_items(void)
 /** getconf handles the initialization from commandline and rc file defaults. */
 void getconf(int argc, char *argv[])
 {
-	int arg, help = 0, version = 0;
-	const char *iface = NULL;
-
-	while ((arg = getopt(argc, argv, "ghi:v")) >= 0) {
+	static const struct option long_opts[] = {
+		{ "scan-json",	no_argument,		NULL, 'J' },
+		{ "scan-csv",	no_argument,		NULL, 'C' },
+		{ "count",	required_argument,	NULL, 'n' },
+		{ NULL,		0,			NULL, 0 }
+	};
+	int arg, help = 0, version = 0, count = 1;
+	enum scan_export_format export = SCAN_EXPORT_NONE;
+	const char *iface = NULL, *survey_file = NULL, *gpsd = NULL, *log_file = NULL;
+
+	while ((arg = getopt_long(argc, argv, "G:ghi:L:S:v", long_opts, NULL)) >= 0) {
 		switch (arg) {
+		case 'J':
+			export = SCAN_EXPORT_JSON;
+			break;
+		case 'C':
+			export = SCAN_EXPORT_CSV;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			if (count < 1)
+				err_quit("invalid scan count '%s'", optarg);
+			break;
+		case 'G':
+			gpsd = optarg;
+			break;
 		case 'g':
 			conf.check_geometry = true;
 			break;
@@ -597,6 +698,12 @@ void getconf(int argc, char *argv[])
 		case 'i':
 			iface = optarg;
 			break;
+		case 'L':
+			log_file = optarg;
+			break;
+		case 'S':
+			survey_file = optarg;
+			break;
 		case 'v':
 			version++;
 			break;
@@ -610,11 +717,18 @@ void getconf(int argc, char *argv[])
 		printf("Distributed under the terms of the GPLv3.\n%s", help ? "\n" : "");
 	}
 	if (help) {
-		printf("usage: %s [ -hgv ] [ -i ifname ]\n", PACKAGE_NAME);
+		printf("usage: %s [ -hgv ] [ -i ifname ] [ -S file ] [ -G gpsd ] [ -L file ]\n"
+		       "               [ --scan-json | --scan-csv [ --count n ] ]\n", PACKAGE_NAME);
+		printf("  -G <gpsd>     Read positions from gpsd at host[:port] or socket path\n");
 		printf("  -g            Ensure screen is sufficiently dimensioned\n");
 		printf("  -h            This help screen\n");
 		printf("  -i <ifname>   Use specified network interface (default: auto)\n");
+		printf("  -L <file>     Log every scan, with position, to <file> (GeoJSON, or CSV if *.csv)\n");
+		printf("  -S <file>     Site-survey mode: append location markers to <file>\n");
 		printf("  -v            Print version details\n");
+		printf("  --scan-json   Scan once, print the results as JSON, and exit\n");
+		printf("  --scan-csv    Scan once, print the results as CSV, and exit\n");
+		printf("  --count <n>   Number of scans for --scan-json/--scan-csv (default: 1)\n");
 	}
 
 	if (version || help) {
@@ -632,5 +746,23 @@ void getconf(int argc, char *argv[])
 			err_quit("%s is not a usable wireless interface", iface);
 	}
 
+	if (gpsd)
+		gps_init(gpsd);
+
+	/* Export mode does not need a terminal, and leaves the configuration file alone. */
+	if (export) {
+		if (survey_file)
+			err_quit("site-survey mode needs the interactive scan window");
+		if (log_file)
+			err_quit("the scan log needs the interactive scan window");
+		scan_export(export, count);
+		exit(EXIT_SUCCESS);
+	}
+
+	if (survey_file)
+		site_survey_init(survey_file);
+	if (log_file)
+		scan_log_init(log_file);
+
 	atexit(write_cf);
 }
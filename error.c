@@ -71,12 +71,15 @@ static void terminate_all_processes(const char *fmt, bool strerr, va_list ap)
 	/*
 	 * wavemon runs in its own process group. Block TERM in this process,
 	 * but send to all others (parent or child), which by default do not
-	 * block TERM.
+	 * block TERM. This does not apply to export mode (no screen), which
+	 * may share the process group of the calling script.
 	 */
-	xsignal(SIGTERM, SIG_IGN);
-	endwin();
-	kill(0, SIGTERM);
-	reset_shell_mode();
+	if (stdscr) {
+		xsignal(SIGTERM, SIG_IGN);
+		endwin();
+		kill(0, SIGTERM);
+		reset_shell_mode();
+	}
 	if (saved_errno) {
 		errno = saved_errno;
 		vwarn(fmt, ap);
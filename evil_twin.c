@@ -0,0 +1,139 @@
+/*
+ * Evil-twin detection: BSSes that do not fit what is known about their ESSID.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * For each ESSID, an &essid_profile collects the combinations of vendor (OUI)
+ * and security setting, and the bands of its BSSes. The BSSes seen in the scan
+ * in which an ESSID first appears form its baseline; a BSS that turns up later
+ * with a combination or band that the ESSID has not used before is flagged. Profiles
+ * are kept with the ESSIDs in the pool of the BSS table, hence within its memory
+ * budget, and are forgotten along with the last BSS of their ESSID. Each BSS
+ * is checked once (and again if its ESSID, security or band changes), at a
+ * cost that does not depend on the number of BSSes or ESSIDs.
+ *
+ * Like the BSS table, this is only used by the thread post-processing scans.
+ */
+#include "iw_scan.h"
+
+/* Security protocol, ciphers, AKMs, privacy and BSS type of @e, in one number. */
+static uint64_t security_sig(const struct scan_entry *e)
+{
+	return (uint64_t)e->sec_proto << 48 | (uint64_t)e->sec_akm << 32 |
+	       (uint64_t)e->sec_pairwise << 16 |
+	       (e->bss_capa & (WLAN_CAPABILITY_ESS | WLAN_CAPABILITY_IBSS | WLAN_CAPABILITY_PRIVACY));
+}
+
+static uint8_t band_bit(uint32_t freq)
+{
+	return freq < 2500 ? 1 << 0 : freq < 5950 ? 1 << 1 : 1 << 2;
+}
+
+/* Vendor prefix of @addr; multi-BSS APs often derive locally-administered BSSIDs. */
+static void bss_oui(const struct ether_addr *addr, uint8_t oui[3])
+{
+	oui[0] = addr->ether_addr_octet[0] & ~0x02;
+	oui[1] = addr->ether_addr_octet[1];
+	oui[2] = addr->ether_addr_octet[2];
+}
+
+/*
+ * A BSS fits its ESSID if another BSS of the ESSID has used the same security
+ * setting with the same vendor prefix. Otherwise, it is flagged for its security
+ * if the vendor is known (with another setting), else for its vendor, and for
+ * its security as well if no BSS of the ESSID has used that setting.
+ */
+static uint8_t profile_mismatch(const struct essid_profile *p, const uint8_t oui[3],
+				uint64_t sig, uint8_t band)
+{
+	uint8_t flags = p->bands & band ? 0 : TWIN_BAND;
+	bool oui_known = false, sec_known = false;
+
+	for (int i = 0; i < p->num_kinds; i++) {
+		const bool same_oui = !memcmp(p->ouis[i], oui, 3);
+
+		if (same_oui && p->secs[i] == sig)
+			return flags;
+		oui_known |= same_oui;
+		sec_known |= p->secs[i] == sig;
+	}
+	if (oui_known || !sec_known)
+		flags |= TWIN_SECURITY;
+	if (!oui_known)
+		flags |= TWIN_OUI;
+	return flags;
+}
+
+static void profile_learn(struct essid_profile *p, const uint8_t oui[3], uint64_t sig, uint8_t band)
+{
+	int i;
+
+	for (i = 0; i < p->num_kinds && (p->secs[i] != sig || memcmp(p->ouis[i], oui, 3)); i++)
+		;
+	if (i == p->num_kinds && i < TWIN_MAX_KINDS) {
+		memcpy(p->ouis[i], oui, 3);
+		p->secs[i] = sig;
+		p->num_kinds++;
+	}
+
+	p->bands |= band;
+}
+
+/**
+ * Check @e, seen in scan number @scan, against the profile of its ESSID, and set
+ * its twin_flags. Returns the flags if @e has only now been found anomalous.
+ */
+uint8_t twin_check(struct scan_entry *e, uint32_t scan)
+{
+	const uint64_t sig = security_sig(e);
+	const uint8_t band = band_bit(e->freq);
+	struct essid_profile *p;
+	struct bss_record *rec;
+	uint32_t key;
+	uint8_t oui[3];
+
+	if (!*e->essid)
+		return 0;
+
+	/* Re-check a known BSS only if its ESSID, security or band changed. */
+	rec = bss_table_get(&e->ap_addr);
+	key = hash_fnv1a(e->essid, strlen(e->essid)) ^ hash_fnv1a(&sig, sizeof(sig)) ^ band;
+	if (rec->twin_checked && rec->twin_key == key) {
+		e->twin_flags = rec->twin_flags;
+		return 0;
+	}
+	rec->twin_checked = true;
+	rec->twin_key     = key;
+
+	bss_oui(&e->ap_addr, oui);
+	p = bss_essid_profile(rec, e->essid);
+	if (!p->first_scan)
+		p->first_scan = scan;
+	e->twin_flags = p->first_scan == scan ? 0 : profile_mismatch(p, oui, sig, band);
+	if (!e->twin_flags)	/* do not let a suspect BSS extend the profile */
+		profile_learn(p, oui, sig, band);
+
+	rec->twin_flags = e->twin_flags;
+	return e->twin_flags;
+}
+
+/** Describe the &enum twin_anomaly bits of @flags. */
+const char *twin_describe(uint8_t flags)
+{
+	static char buf[64];
+	size_t len = 0;
+
+	buf[0] = '\0';
+	if (flags & TWIN_SECURITY)
+		len += snprintf(buf + len, sizeof(buf) - len, "security");
+	if (flags & TWIN_OUI)
+		len += snprintf(buf + len, sizeof(buf) - len, "%sOUI", len ? ", " : "");
+	if (flags & TWIN_BAND)
+		snprintf(buf + len, sizeof(buf) - len, "%sband", len ? ", " : "");
+	return buf;
+}
+
+/** Append @ev to @r, overwriting the oldest event if full. */
+void scan_event_push(struct scan_event_ring *r, const struct scan_event *ev)
+{
+	r->ev[r->count++ % MAX_SCAN_EVENTS] = *ev;
+}
@@ -0,0 +1,195 @@
+/*
+ * GPS position from gpsd, read via its JSON protocol.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * A reader thread connects to gpsd (via TCP, or a UNIX socket if the address is
+ * a path), enables watch mode, and keeps the position of the latest TPV (time-
+ * position-velocity) report. Consumers only copy that fix under a mutex, so that
+ * a slow or absent gpsd never delays a scan. Lost connections are retried.
+ */
+#include "iw_scan.h"
+#include <sys/un.h>
+
+#define GPS_DEFAULT_PORT	"2947"
+
+/* Age in seconds after which a fix is no longer reported. */
+#define GPS_MAX_AGE		5
+
+/* Delay between connection attempts, in seconds. */
+#define GPS_RETRY_DELAY		5
+
+static char *gps_host, *gps_port;
+static pthread_t gps_thread;
+static pthread_mutex_t gps_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct gps_fix gps_latest;
+static time_t gps_received;		/* when @gps_latest was received */
+
+/* Connect to the UNIX socket @path, returning the socket or -1. */
+static int gps_connect_unix(const char *path)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", path);
+	if (fd >= 0 && connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+/* Connect to gpsd, returning the socket or -1. */
+static int gps_connect(void)
+{
+	struct addrinfo hints = { .ai_socktype = SOCK_STREAM }, *res, *ai;
+	int fd = -1;
+
+	if (!gps_port)
+		return gps_connect_unix(gps_host);
+
+	if (getaddrinfo(gps_host, gps_port, &hints, &res))
+		return -1;
+	for (ai = res; ai && fd < 0; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+/* Look up the number @key in the JSON object @line (gpsd objects are flat). */
+static bool json_number(const char *line, const char *key, double *v)
+{
+	char pat[32], *end;
+	const char *p;
+
+	snprintf(pat, sizeof(pat), "\"%s\":", key);
+	p = strstr(line, pat);
+	if (!p)
+		return false;
+	p += strlen(pat);
+	*v = strtod(p, &end);
+	return end != p;
+}
+
+/* Time of the TPV report @line, in ISO 8601 UTC (e.g. "2026-01-01T12:00:00.000Z"). */
+static time_t tpv_time(const char *line)
+{
+	const char *p = strstr(line, "\"time\":\"");
+	struct tm tm = { .tm_isdst = 0 };
+
+	if (!p || !strptime(p + strlen("\"time\":\""), "%Y-%m-%dT%H:%M:%S", &tm))
+		return time(NULL);
+	return timegm(&tm);
+}
+
+/* Update the latest fix from the gpsd report @line, ignoring all but TPV reports. */
+static void gps_parse(const char *line)
+{
+	struct gps_fix fix = { .mode = 0 };
+	double mode;
+
+	if (!strstr(line, "\"class\":\"TPV\"") || !json_number(line, "mode", &mode))
+		return;
+
+	/* Mode 1 means that there is no fix. */
+	if (mode >= 2 && json_number(line, "lat", &fix.lat) && json_number(line, "lon", &fix.lon)) {
+		fix.mode = mode >= 3 ? 3 : 2;
+		fix.time = tpv_time(line);
+		/* Older gpsd versions only report "alt". */
+		if (fix.mode == 3 && !json_number(line, "altMSL", &fix.alt) &&
+		    !json_number(line, "alt", &fix.alt))
+			fix.mode = 2;
+	}
+
+	pthread_mutex_lock(&gps_mutex);
+	gps_latest   = fix;
+	gps_received = time(NULL);
+	pthread_mutex_unlock(&gps_mutex);
+}
+
+static void *gps_reader(void *arg)
+{
+	static const char watch[] = "?WATCH={\"enable\":true,\"json\":true};\n";
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp;
+	int fd;
+
+	(void)arg;
+	for (;; sleep(GPS_RETRY_DELAY)) {
+		fd = gps_connect();
+		if (fd < 0)
+			continue;
+		fp = fdopen(fd, "r");
+		if (!fp) {
+			close(fd);
+			continue;
+		}
+		if (write(fd, watch, sizeof(watch) - 1) == sizeof(watch) - 1)
+			while (getline(&line, &len, fp) > 0)
+				gps_parse(line);
+		fclose(fp);
+
+		pthread_mutex_lock(&gps_mutex);
+		gps_latest.mode = 0;
+		pthread_mutex_unlock(&gps_mutex);
+	}
+	return NULL;
+}
+
+/**
+ * Start reading positions from gpsd at @addr, which is either the path of a
+ * UNIX socket, or host[:port] (an IPv6 address in brackets if with a port).
+ */
+void gps_init(const char *addr)
+{
+	sigset_t blockmask, oldmask;
+	char *colon;
+
+	gps_host = strdup(addr);
+	if (!gps_host)
+		err_sys("unable to allocate gpsd address");
+	if (*gps_host != '/') {
+		colon = strrchr(gps_host, ':');
+		if (*gps_host == '[' && (!colon || colon[-1] != ']'))
+			colon = NULL;
+		else if (*gps_host != '[' && colon && strchr(gps_host, ':') != colon)
+			colon = NULL;	/* IPv6 address without port */
+		gps_port = GPS_DEFAULT_PORT;
+		if (colon) {
+			*colon   = '\0';
+			gps_port = colon + 1;
+		}
+		if (*gps_host == '[') {
+			gps_host++;
+			gps_host[strlen(gps_host) - 1] = '\0';
+		}
+	}
+
+	/* SIGWINCH is supposed to be handled in the main thread. */
+	sigemptyset(&blockmask);
+	sigaddset(&blockmask, SIGWINCH);
+	pthread_sigmask(SIG_BLOCK, &blockmask, &oldmask);
+	pthread_create(&gps_thread, NULL, gps_reader, NULL);
+	pthread_detach(gps_thread);
+	pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+}
+
+bool gps_enabled(void)
+{
+	return gps_host != NULL;
+}
+
+/** Store the latest fix in @fix (with @fix->mode 0 if there is none, or it is too old). */
+void gps_get_fix(struct gps_fix *fix)
+{
+	pthread_mutex_lock(&gps_mutex);
+	*fix = gps_latest;
+	if (time(NULL) - gps_received > GPS_MAX_AGE)
+		fix->mode = 0;
+	pthread_mutex_unlock(&gps_mutex);
+}
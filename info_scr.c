@@ -19,72 +19,83 @@
  */
 #include "iw_if.h"
 #include "iw_nl80211.h"
+#include <poll.h>
 
 /* GLOBALS */
 static WINDOW *w_levels, *w_stats, *w_if, *w_info, *w_net;
-static pthread_t sampling_thread;
 static time_t last_update;
 
-/* Linkstat pointers, shared between sampling thread and UI main thread. */
-static struct iw_nl80211_linkstat *ls_tmp = NULL,
-				  *ls_cur = NULL,
-				  *ls_new = NULL;
-static pthread_mutex_t linkstat_mutex;
-
-/** Sampling pthread - shared by info and level-history screen. */
-static void *sampling_loop(void *arg)
+/* Latest sample of the sampling service, as displayed. */
+static struct iw_nl80211_linkstat info_ls, *ls_cur = &info_ls;
+static int sample_fd;			/* readable while samples are pending */
+static unsigned ring_backlog,		/* samples pending at the last wakeup */
+		ring_dropped;		/* samples lost since the ring was full */
+
+/**
+ * struct levels - the levels shown, smoothed over all samples
+ * @qual:         link quality
+ * @signal:       signal level in dBm
+ * @noise:        noise level in dBm
+ * @ssnr:         signal-to-noise ratio in dB
+ * @sig_qual:     link quality of the last sample, -1 if unknown
+ * @sig_qual_max: maximum of @sig_qual
+ * @sig_level:    signal level of the last sample, 0 if unknown
+ */
+static struct levels {
+	float	qual,
+		signal,
+		noise,
+		ssnr;
+	int	sig_qual,
+		sig_qual_max,
+		sig_level;
+} lvl = { .sig_qual = -1 };
+
+/* Add the sample @ls to the smoothed levels. */
+static void update_levels(const struct iw_nl80211_linkstat *ls)
 {
-	const bool do_not_swap_pointers = (bool)arg;
-	sigset_t blockmask;
-
-	/* See comment in iw_scan.c for rationale of blocking SIGWINCH. */
-	sigemptyset(&blockmask);
-	sigaddset(&blockmask, SIGWINCH);
-	pthread_sigmask(SIG_BLOCK, &blockmask, NULL);
-
-	do {
-		if (!ls_new && ls_tmp) {
-			iw_nl80211_get_linkstat(ls_tmp);
-			iw_cache_update(ls_tmp);
-
-			if (do_not_swap_pointers)
-				continue;
-			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-			pthread_mutex_lock(&linkstat_mutex);
-			ls_new = ls_tmp;
-			ls_tmp = NULL;
-			pthread_mutex_unlock(&linkstat_mutex);
-			pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-		}
-	} while (usleep(conf.stat_iv * 1000) == 0);
-	return NULL;
-}
+	const double weight = conf.meter_decay / 100.0;
 
-/* Start thread. Ensure that !ls_new && ls_tmp. */
-void sampling_init(bool do_not_swap_pointers)
-{
-	if (!ls_tmp && !ls_cur) {
-		ls_tmp = calloc(1, sizeof(*ls_tmp));
-		ls_cur = calloc(1, sizeof(*ls_cur));
-		if (!ls_tmp || !ls_cur)
-			err_sys("Out of memory");
-	} else if (ls_new && !ls_tmp) { /* Old state from previous run. */
-		ls_tmp = ls_cur;
-		ls_cur = ls_new;
-		ls_new = NULL;
+	lvl.sig_level = ls->signal;
+
+	/* See comments in iw_cache_update */
+	if (lvl.sig_level == 0)
+		lvl.sig_level = ls->signal_avg;
+	if (lvl.sig_level == 0)
+		lvl.sig_level = ls->bss_signal;
+
+	/* If the signal level is positive, assume it is an absolute value (#100). */
+	if (lvl.sig_level > 0)
+		lvl.sig_level *= -1;
+
+	lvl.sig_qual = -1;
+	if (ls->bss_signal_qual) {
+		/* BSS_SIGNAL_UNSPEC is scaled 0..100 */
+		lvl.sig_qual     = ls->bss_signal_qual;
+		lvl.sig_qual_max = 100;
+	} else if (lvl.sig_level) {
+		if (lvl.sig_level < -110)
+			lvl.sig_qual = 0;
+		else if (lvl.sig_level > -40)
+			lvl.sig_qual = 70;
+		else
+			lvl.sig_qual = lvl.sig_level + 110;
+		lvl.sig_qual_max = 70;
 	}
-	pthread_create(&sampling_thread, NULL, sampling_loop, (void*)do_not_swap_pointers);
-}
 
-void sampling_stop(void)
-{
-	pthread_cancel(sampling_thread);
-	pthread_join(sampling_thread, NULL);
+	if (lvl.sig_qual != -1)
+		lvl.qual = ewma(lvl.qual, lvl.sig_qual, weight);
+	if (lvl.sig_level)
+		lvl.signal = ewma(lvl.signal, lvl.sig_level, weight);
+	if (ls->survey.freq && ls->survey.noise) {
+		lvl.noise = ewma(lvl.noise, ls->survey.noise, weight);
+		if (lvl.sig_level)
+			lvl.ssnr = ewma(lvl.ssnr, lvl.sig_level - ls->survey.noise, weight);
+	}
 }
 
 static void display_levels(void)
 {
-	static float qual, signal, noise, ssnr;
 	/*
 	 * FIXME: revise the scale implementation. It does not work
 	 *        satisfactorily, maybe it is better to have a simple
@@ -94,58 +105,28 @@ static void display_levels(void)
 	     lvlscale[2] = { -40, -20};
 	char tmp[0x100];
 	int line;
-	bool noise_data_valid;
-	int sig_qual = -1, sig_qual_max = 0, sig_level = 0;
-
-	noise_data_valid = iw_nl80211_have_survey_data(ls_cur);
-	sig_level = ls_cur->signal;
-
-	/* See comments in iw_cache_update */
-	if (sig_level == 0)
-		sig_level = ls_cur->signal_avg;
-	if (sig_level == 0)
-		sig_level = ls_cur->bss_signal;
-
-	/* If the signal level is positive, assume it is an absolute value (#100). */
-	if (sig_level > 0)
-		sig_level *= -1;
+	bool noise_data_valid = iw_nl80211_have_survey_data(ls_cur);
 
 	for (line = 1; line <= WH_LEVEL; line++)
 		mvwclrtoborder(w_levels, line, 1);
 
-	if (ls_cur->bss_signal_qual) {
-		/* BSS_SIGNAL_UNSPEC is scaled 0..100 */
-		sig_qual     = ls_cur->bss_signal_qual;
-		sig_qual_max = 100;
-	} else if (sig_level) {
-		if (sig_level < -110)
-			sig_qual = 0;
-		else if (sig_level > -40)
-			sig_qual = 70;
-		else
-			sig_qual = sig_level + 110;
-		sig_qual_max = 70;
-	}
-
 	line = 1;
 
 	/* Noise data is rare. Use the space for spreading out. */
 	if (!noise_data_valid)
 		line++;
 
-	if (sig_qual == -1) {
+	if (lvl.sig_qual == -1) {
 		line++;
 	} else {
-		qual = ewma(qual, sig_qual, conf.meter_decay / 100.0);
-
 		mvwclrtoborder(w_levels, line, 1);
 		mvwaddstr(w_levels, line++, 1, "link quality: ");
-		sprintf(tmp, "%0.f%%  ", (1e2 * qual)/sig_qual_max);
+		sprintf(tmp, "%0.f%%  ", (1e2 * lvl.qual)/lvl.sig_qual_max);
 		waddstr_b(w_levels, tmp);
-		sprintf(tmp, "(%0.f/%d)  ", qual, sig_qual_max);
+		sprintf(tmp, "(%0.f/%d)  ", lvl.qual, lvl.sig_qual_max);
 		waddstr(w_levels, tmp);
 
-		waddbar(w_levels, line++, qual, 0, sig_qual_max, lvlscale, true);
+		waddbar(w_levels, line++, lvl.qual, 0, lvl.sig_qual_max, lvlscale, true);
 	}
 
 	/* Spacer */
@@ -153,42 +134,35 @@ static void display_levels(void)
 	if (!noise_data_valid)
 		line++;
 
-	if (sig_level != 0) {
-		signal = ewma(signal, sig_level, conf.meter_decay / 100.0);
-
+	if (lvl.sig_level != 0) {
 		mvwclrtoborder(w_levels, line, 1);
 		mvwaddstr(w_levels, line++, 1, "signal level: ");
-		sprintf(tmp, "%.0f dBm (%s)", signal, dbm2units(signal));
+		sprintf(tmp, "%.0f dBm (%s)", lvl.signal, dbm2units(lvl.signal));
 		waddstr_b(w_levels, tmp);
 
-		waddbar(w_levels, line, signal, conf.sig_min, conf.sig_max,
+		waddbar(w_levels, line, lvl.signal, conf.sig_min, conf.sig_max,
 			lvlscale, true);
 		if (conf.lthreshold_action)
-			waddthreshold(w_levels, line, signal, conf.lthreshold,
+			waddthreshold(w_levels, line, lvl.signal, conf.lthreshold,
 				      conf.sig_min, conf.sig_max, lvlscale, '>');
 		if (conf.hthreshold_action)
-			waddthreshold(w_levels, line, signal, conf.hthreshold,
+			waddthreshold(w_levels, line, lvl.signal, conf.hthreshold,
 				      conf.sig_min, conf.sig_max, lvlscale, '<');
 	}
 
 	line++;
 
 	if (noise_data_valid) {
-		noise = ewma(noise, ls_cur->survey.noise, conf.meter_decay / 100.0);
-
 		mvwaddstr(w_levels, line++, 1, "noise level:  ");
-		sprintf(tmp, "%.0f dBm (%s)", noise, dbm2units(noise));
+		sprintf(tmp, "%.0f dBm (%s)", lvl.noise, dbm2units(lvl.noise));
 		waddstr_b(w_levels, tmp);
 
-		waddbar(w_levels, line++, noise, conf.noise_min, conf.noise_max,
+		waddbar(w_levels, line++, lvl.noise, conf.noise_min, conf.noise_max,
 			nscale, false);
 
-		if (sig_level) {
-			ssnr = ewma(ssnr, sig_level - ls_cur->survey.noise,
-					  conf.meter_decay / 100.0);
-
+		if (lvl.sig_level) {
 			mvwaddstr(w_levels, line++, 1, "SNR:           ");
-			sprintf(tmp, "%.0f dB", ssnr);
+			sprintf(tmp, "%.0f dB", lvl.ssnr);
 			waddstr_b(w_levels, tmp);
 		}
 	} else {
@@ -268,6 +242,17 @@ static void display_packet_counts(void)
 		waddstr(w_stats, ", failed: ");
 		waddstr_b(w_stats, int_counts(ls_cur->tx_failed));
 	}
+
+	/* Only shown if the screen falls behind the sampler. */
+	if (ring_backlog > 1 || ring_dropped) {
+		waddstr(w_stats, ", backlog: ");
+		sprintf(tmp, "%u", ring_backlog);
+		waddstr_b(w_stats, tmp);
+		if (ring_dropped) {
+			sprintf(tmp, " (%s lost)", int_counts(ring_dropped));
+			waddstr(w_stats, tmp);
+		}
+	}
 	wclrtoborder(w_stats);
 	wrefresh(w_stats);
 }
@@ -799,8 +784,6 @@ static void display_static_parts(WINDOW *w_if, WINDOW *w_info, WINDOW *w_net)
 void scr_info_init(void)
 {
 	int line = 0;
-	bool ready = false;
-	static bool initialized = false;
 
 	w_if	 = newwin_title(line, WH_IFACE, "Interface", true);
 	line += WH_IFACE;
@@ -812,52 +795,52 @@ void scr_info_init(void)
 	line += WH_INFO;
 	w_net = newwin_title(line, WH_NET, "Network", false);
 
-	if (!initialized) {
-		pthread_mutexattr_t attr;
-
-		pthread_mutexattr_init(&attr);
-		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
-		pthread_mutex_init(&linkstat_mutex, &attr);
-		initialized = true;
-	}
-
-	sampling_init(false);
-
-	while (!ready) {
-		pthread_mutex_lock(&linkstat_mutex);
-		ready = ls_new && !ls_tmp;
-		pthread_mutex_unlock(&linkstat_mutex);
-	}
+	/* Waits for the first sample after startup; later ones come through the ring. */
+	sample_fd = sampling_ring_attach();
+	sampling_get(&info_ls, 0, NULL);
+	update_levels(&info_ls);
+	display_levels();
+	display_packet_counts();
 }
 
 int scr_info_loop(WINDOW *w_menu)
 {
+	struct pollfd pfd[2] = {
+		{ .fd = STDIN_FILENO, .events = POLLIN },
+		{ .fd = sample_fd,    .events = POLLIN },
+	};
+	struct linkstat_sample s;
+	bool have_samples = false;
 	time_t now = time(NULL);
 
-	if (pthread_mutex_trylock(&linkstat_mutex) == 0) {
-		if (ls_new && !ls_tmp) {
-			ls_tmp = ls_cur;
-			ls_cur = ls_new;
-			ls_new = NULL;
-		}
-		pthread_mutex_unlock(&linkstat_mutex);
-	}
-	display_levels();
-	display_packet_counts();
-
 	if (now - last_update >= conf.info_iv) {
 		last_update = now;
 		display_static_parts(w_if, w_info, w_net);
 	}
+
+	/* Sleep until there is input, a new sample, or the static parts are due. */
+	if (poll(pfd, 2, 1000) < 0 && errno != EINTR)
+		err_sys("poll failed");
+
+	/* Take every sample, so that the smoothed levels include all of them. */
+	ring_backlog = sampling_ring_depth(&ring_dropped);
+	while (sampling_ring_pop(&s)) {
+		info_ls = s.ls;
+		update_levels(&info_ls);
+		have_samples = true;
+	}
+	if (have_samples) {
+		display_levels();
+		display_packet_counts();
+	}
 	return wgetch(w_menu);
 }
 
 void scr_info_fini(void)
 {
-	/* Unlock mutex in case it was taken when scr_info_loop got interrupted by a SIGWINCH. */
-	pthread_mutex_unlock(&linkstat_mutex);
-	sampling_stop();
-	last_update = 0;
+	sampling_ring_detach();
+	last_update  = 0;
+	ring_backlog = ring_dropped = 0;
 
 	delwin(w_net);
 	delwin(w_info);
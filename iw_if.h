@@ -144,8 +144,9 @@ struct iw_levelstat {
 /*
  * 	Periodic sampling of wireless statistics
  */
-extern void sampling_init(bool do_not_swap_pointers);
-extern void sampling_stop(void);
+struct iw_nl80211_linkstat;
+extern void sampling_init(void);
+extern uint32_t sampling_get(struct iw_nl80211_linkstat *ls, uint32_t gen, uint64_t *when);
 
 /*
  * rfkill.c
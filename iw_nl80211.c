@@ -11,7 +11,7 @@
 #include "iw_nl80211.h"
 
 /** Append msg_attribute{type, len, data} to @cmd. */
-static void add_msg_arg(struct cmd *cmd, int type, size_t len, const void * const data)
+void add_msg_arg(struct cmd *cmd, int type, size_t len, const void * const data)
 {
 	cmd->msg_args = realloc(cmd->msg_args, sizeof(*cmd->msg_args) * (cmd->msg_args_len + 1));
 	if (!cmd->msg_args)
@@ -115,6 +115,19 @@ out:
 	return ret;
 }
 
+/**
+ * handle_ifindex_cmd: handle @cmd for the interface with index @ifindex.
+ * Safe to use concurrently with other commands, as long as each thread uses
+ * its own @cmd (and hence socket).
+ */
+int handle_ifindex_cmd(struct cmd *cmd, uint32_t ifindex)
+{
+	/* netdev identifier: interface index */
+	add_msg_arg(cmd, NL80211_ATTR_IFINDEX, sizeof(ifindex), &ifindex);
+
+	return handle_cmd(cmd);
+}
+
 /**
  * handle_interface_cmd: handle @cmd for the configured default interface.
  */
@@ -125,10 +138,7 @@ int handle_interface_cmd(struct cmd *cmd)
 	if (ifindex == 0 && errno)
 		err_sys("failed to look up interface index of '%s'", conf_ifname());
 
-	/* netdev identifier: interface index */
-	add_msg_arg(cmd, NL80211_ATTR_IFINDEX, sizeof(ifindex), &ifindex);
-
-	return handle_cmd(cmd);
+	return handle_ifindex_cmd(cmd, ifindex);
 }
 
 /*
@@ -336,17 +346,44 @@ static int phy_handler(struct nl_msg *msg, void *arg)
 	return NL_SKIP;
 }
 
-/**
- * survey_handler - channel survey data
- * This handler will be called multiple times, for each channel.
- * stolen from iw:survey.c
- */
-static int survey_handler(struct nl_msg *msg, void *arg)
+/* Collect the enabled channels of all bands; called once per part of a split dump. */
+static int freqs_handler(struct nl_msg *msg, void *arg)
+{
+	struct iw_nl80211_freqs *fl = arg;
+	struct nlattr *tb_msg[NL80211_ATTR_MAX + 1];
+	struct nlattr *tb_band[NL80211_BAND_ATTR_MAX + 1];
+	struct nlattr *tb_freq[NL80211_FREQUENCY_ATTR_MAX + 1];
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *nl_band, *nl_freq;
+	int rem_band, rem_freq;
+
+	nla_parse(tb_msg, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+		  genlmsg_attrlen(gnlh, 0), NULL);
+
+	if (!tb_msg[NL80211_ATTR_WIPHY_BANDS])
+		return NL_SKIP;
+
+	nla_for_each_nested(nl_band, tb_msg[NL80211_ATTR_WIPHY_BANDS], rem_band) {
+		nla_parse(tb_band, NL80211_BAND_ATTR_MAX, nla_data(nl_band), nla_len(nl_band), NULL);
+		if (!tb_band[NL80211_BAND_ATTR_FREQS])
+			continue;
+
+		nla_for_each_nested(nl_freq, tb_band[NL80211_BAND_ATTR_FREQS], rem_freq) {
+			nla_parse(tb_freq, NL80211_FREQUENCY_ATTR_MAX, nla_data(nl_freq), nla_len(nl_freq), NULL);
+			if (!tb_freq[NL80211_FREQUENCY_ATTR_FREQ] || tb_freq[NL80211_FREQUENCY_ATTR_DISABLED])
+				continue;
+			if (fl->num < MAX_PHY_FREQS)
+				fl->freq[fl->num++] = nla_get_u32(tb_freq[NL80211_FREQUENCY_ATTR_FREQ]);
+		}
+	}
+	return NL_SKIP;
+}
+
+/* Parse the survey information of @msg into @sinfo. Returns false if absent. */
+static bool parse_survey_info(struct nl_msg *msg, struct nlattr *sinfo[])
 {
-	struct iw_nl80211_survey *sd = (struct iw_nl80211_survey *)arg;
 	struct nlattr *tb[NL80211_ATTR_MAX + 1];
 	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
-	struct nlattr *sinfo[NL80211_SURVEY_INFO_MAX + 1];
 
 	static struct nla_policy survey_policy[NL80211_SURVEY_INFO_MAX + 1] = {
 		[NL80211_SURVEY_INFO_FREQUENCY]     = { .type = NLA_U32 },
@@ -364,20 +401,19 @@ static int survey_handler(struct nl_msg *msg, void *arg)
 		  genlmsg_attrlen(gnlh, 0), NULL);
 
 	if (!tb[NL80211_ATTR_SURVEY_INFO])
-		return NL_SKIP;
+		return false;
 
 	if (nla_parse_nested(sinfo, NL80211_SURVEY_INFO_MAX,
 			     tb[NL80211_ATTR_SURVEY_INFO], survey_policy))
-		return NL_SKIP;
+		return false;
 
-	/* The frequency is needed to match up with the associated station */
-	if (!sinfo[NL80211_SURVEY_INFO_FREQUENCY])
-		return NL_SKIP;
-
-	/* We are only interested in the data of the operating channel */
-	if (!sinfo[NL80211_SURVEY_INFO_IN_USE])
-		return NL_SKIP;
+	/* The frequency is needed to match up with channels/stations */
+	return sinfo[NL80211_SURVEY_INFO_FREQUENCY] != NULL;
+}
 
+/* Fill in @sd from the parsed survey information @sinfo. */
+static void fill_survey_data(struct iw_nl80211_survey *sd, struct nlattr *sinfo[])
+{
 	sd->freq  = nla_get_u32(sinfo[NL80211_SURVEY_INFO_FREQUENCY]);
 
 	if (sinfo[NL80211_SURVEY_INFO_NOISE])
@@ -400,6 +436,43 @@ static int survey_handler(struct nl_msg *msg, void *arg)
 
 	if (sinfo[NL80211_SURVEY_INFO_TIME_SCAN])
 		sd->time.scan = nla_get_u64(sinfo[NL80211_SURVEY_INFO_TIME_SCAN]);
+}
+
+/**
+ * survey_handler - channel survey data
+ * This handler will be called multiple times, for each channel.
+ * stolen from iw:survey.c
+ */
+static int survey_handler(struct nl_msg *msg, void *arg)
+{
+	struct iw_nl80211_survey *sd = (struct iw_nl80211_survey *)arg;
+	struct nlattr *sinfo[NL80211_SURVEY_INFO_MAX + 1];
+
+	if (!parse_survey_info(msg, sinfo))
+		return NL_SKIP;
+
+	/* We are only interested in the data of the operating channel */
+	if (!sinfo[NL80211_SURVEY_INFO_IN_USE])
+		return NL_SKIP;
+
+	fill_survey_data(sd, sinfo);
+	return NL_SKIP;
+}
+
+/* Like survey_handler, but collects the data of all channels. */
+static int survey_dump_handler(struct nl_msg *msg, void *arg)
+{
+	struct iw_nl80211_survey_dump *sd = (struct iw_nl80211_survey_dump *)arg;
+	struct nlattr *sinfo[NL80211_SURVEY_INFO_MAX + 1];
+
+	if (!parse_survey_info(msg, sinfo))
+		return NL_SKIP;
+
+	sd->chans = realloc(sd->chans, (sd->num + 1) * sizeof(*sd->chans));
+	if (!sd->chans)
+		err_sys("unable to allocate channel survey data");
+	memset(sd->chans + sd->num, 0, sizeof(*sd->chans));
+	fill_survey_data(sd->chans + sd->num++, sinfo);
 
 	return NL_SKIP;
 }
@@ -410,6 +483,8 @@ static int reg_handler(struct nl_msg *msg, void *arg)
 	struct iw_nl80211_reg *ir = (struct iw_nl80211_reg *)arg;
 	struct nlattr *tb_msg[NL80211_ATTR_MAX + 1];
 	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *nl_rule;
+	int rem_rule;
 	char *alpha2;
 
 	ir->region = -1;
@@ -432,6 +507,30 @@ static int reg_handler(struct nl_msg *msg, void *arg)
 	ir->country[0] = alpha2[0];
 	ir->country[1] = alpha2[1];
 
+	nla_for_each_nested(nl_rule, tb_msg[NL80211_ATTR_REG_RULES], rem_rule) {
+		struct nlattr *tb_rule[NL80211_REG_RULE_ATTR_MAX + 1];
+		struct iw_nl80211_reg_rule *rule;
+
+		if (ir->num_rules == MAX_REG_RULES)
+			break;
+
+		nla_parse(tb_rule, NL80211_REG_RULE_ATTR_MAX,
+			  nla_data(nl_rule), nla_len(nl_rule), NULL);
+
+		if (!tb_rule[NL80211_ATTR_FREQ_RANGE_START] ||
+		    !tb_rule[NL80211_ATTR_FREQ_RANGE_END])
+			continue;
+
+		/* Frequencies and bandwidth are given in kHz */
+		rule = ir->rules + ir->num_rules++;
+		rule->start = nla_get_u32(tb_rule[NL80211_ATTR_FREQ_RANGE_START]) / 1000;
+		rule->end   = nla_get_u32(tb_rule[NL80211_ATTR_FREQ_RANGE_END]) / 1000;
+		if (tb_rule[NL80211_ATTR_FREQ_RANGE_MAX_BW])
+			rule->max_bw = nla_get_u32(tb_rule[NL80211_ATTR_FREQ_RANGE_MAX_BW]) / 1000;
+		if (tb_rule[NL80211_ATTR_REG_RULE_FLAGS])
+			rule->flags = nla_get_u32(tb_rule[NL80211_ATTR_REG_RULE_FLAGS]);
+	}
+
 	return NL_SKIP;
 }
 
@@ -693,17 +792,59 @@ void iw_nl80211_get_linkstat(struct iw_nl80211_linkstat *ls)
 	iw_nl80211_get_survey(&ls->survey);
 }
 
+static void getreg(struct cmd *cmd_reg, struct iw_nl80211_reg *ir)
+{
+	cmd_reg->cmd	     = NL80211_CMD_GET_REG;
+	cmd_reg->handler     = reg_handler;
+	cmd_reg->handler_arg = ir;
+	memset(ir, 0, sizeof(*ir));
+	handle_interface_cmd(cmd_reg);
+}
+
+/** Fill in @ir with the regulatory domain. Main-thread use only. */
 void iw_nl80211_getreg(struct iw_nl80211_reg *ir)
 {
-	static struct cmd cmd_reg = {
-		.cmd	 = NL80211_CMD_GET_REG,
-		.flags	 = 0,
-		.handler = reg_handler
-	};
+	static struct cmd cmd_reg;
 
-	cmd_reg.handler_arg = ir;
-	memset(ir, 0, sizeof(*ir));
-	handle_interface_cmd(&cmd_reg);
+	getreg(&cmd_reg, ir);
+}
+
+/**
+ * Like iw_nl80211_getreg(), but for the scan thread: it has its own command (and
+ * netlink socket), so that it is safe to use in parallel to the info screen.
+ */
+void iw_nl80211_scan_getreg(struct iw_nl80211_reg *ir)
+{
+	static struct cmd cmd_reg;
+
+	getreg(&cmd_reg, ir);
+}
+
+/**
+ * Fill in @fl with the enabled channels of the PHY of the default interface.
+ * Safe to use in parallel to the other (main-thread) PHY queries.
+ */
+void iw_nl80211_get_freqs(struct iw_nl80211_freqs *fl)
+{
+	static struct cmd cmd_freqs;
+
+	iw_nl80211_get_ifindex_freqs(&cmd_freqs, if_nametoindex(conf_ifname()), fl);
+}
+
+/**
+ * Like iw_nl80211_get_freqs(), for the PHY of interface @ifindex, using @cmd
+ * (which is safe in parallel to other threads that use their own command).
+ */
+void iw_nl80211_get_ifindex_freqs(struct cmd *cmd, uint32_t ifindex, struct iw_nl80211_freqs *fl)
+{
+	cmd->cmd	 = NL80211_CMD_GET_WIPHY;
+	cmd->flags	 = NLM_F_DUMP;
+	cmd->handler	 = freqs_handler;
+	cmd->handler_arg = fl;
+	memset(fl, 0, sizeof(*fl));
+	/* Kernels without split dumps ignore the flag, and send all bands at once. */
+	add_msg_arg(cmd, NL80211_ATTR_SPLIT_WIPHY_DUMP, 0, NULL);
+	handle_ifindex_cmd(cmd, ifindex);
 }
 
 /** Check kernel for split-wiphy support. Single-thread use only. */
@@ -779,6 +920,20 @@ void iw_nl80211_get_survey(struct iw_nl80211_survey *sd)
 	handle_interface_cmd(&cmd_survey);
 }
 
+/** Collect survey data of all channels into @sd, free @sd->chans after use. */
+void iw_nl80211_get_survey_dump(struct iw_nl80211_survey_dump *sd)
+{
+	static struct cmd cmd_survey_dump = {
+		.cmd	 = NL80211_CMD_GET_SURVEY,
+		.flags	 = NLM_F_DUMP,
+		.handler = survey_dump_handler
+	};
+
+	cmd_survey_dump.handler_arg = sd;
+	memset(sd, 0, sizeof(*sd));
+	handle_interface_cmd(&cmd_survey_dump);
+}
+
 /*
  * Multicast Handling
  */
@@ -57,7 +57,9 @@ struct cmd {
 	struct msg_attribute	*msg_args;
 	size_t			msg_args_len;
 };
+extern void add_msg_arg(struct cmd *cmd, int type, size_t len, const void * const data);
 extern int handle_cmd(struct cmd *cmd);
+extern int handle_ifindex_cmd(struct cmd *cmd, uint32_t ifindex);
 extern int handle_interface_cmd(struct cmd *cmd);
 
 
@@ -144,6 +146,17 @@ struct iw_nl80211_survey {
 };
 extern void iw_nl80211_get_survey(struct iw_nl80211_survey *sd);
 
+/**
+ * struct iw_nl80211_survey_dump - channel survey data of all channels
+ * @chans: array of survey data, one entry per channel
+ * @num:   length of @chans
+ */
+struct iw_nl80211_survey_dump {
+	struct iw_nl80211_survey	*chans;
+	size_t				num;
+};
+extern void iw_nl80211_get_survey_dump(struct iw_nl80211_survey_dump *sd);
+
 /* struct iw_nl80211_linkstat - aggregate link statistics
  * @status:           association status (%nl80211_bss_status)
  * @bssid:            station MAC address
@@ -222,22 +235,73 @@ struct iw_nl80211_linkstat {
 extern void iw_nl80211_get_linkstat(struct iw_nl80211_linkstat *ls);
 extern void iw_cache_update(struct iw_nl80211_linkstat *ls);
 
+/**
+ * struct linkstat_sample - a sample of the sampling service
+ * @time: CLOCK_MONOTONIC time of the sample, in ns
+ * @ls:   the link statistics
+ */
+struct linkstat_sample {
+	uint64_t			time;
+	struct iw_nl80211_linkstat	ls;
+};
+extern int sampling_ring_attach(void);
+extern void sampling_ring_detach(void);
+extern bool sampling_ring_pop(struct linkstat_sample *s);
+extern unsigned sampling_ring_depth(unsigned *dropped);
+
 /* Indicate whether @ls contains usable channel survey data */
 static inline bool iw_nl80211_have_survey_data(struct iw_nl80211_linkstat *ls)
 {
 	return ls->survey.freq != 0 && ls->survey.noise != 0;
 }
 
+/**
+ * struct iw_nl80211_reg_rule - regulatory rule
+ * @start:  start of the frequency range in MHz
+ * @end:    end of the frequency range in MHz
+ * @max_bw: maximum allowed bandwidth in MHz
+ * @flags:  %nl80211_reg_rule_flags (DFS, NO_IR, ...)
+ */
+struct iw_nl80211_reg_rule {
+	uint32_t	start,
+			end,
+			max_bw,
+			flags;
+};
+
+/* Maximum number of regulatory rules retained in &iw_nl80211_reg. */
+#define MAX_REG_RULES	32
+
 /**
  * struct iw_nl80211_reg - regulatory domain information
- * @region:  regulatory DFS region (%nl80211_dfs_regions or -1)
- * @country: two-character country code
+ * @region:    regulatory DFS region (%nl80211_dfs_regions or -1)
+ * @country:   two-character country code
+ * @rules:     regulatory rules of @country
+ * @num_rules: number of valid entries in @rules
  */
 struct iw_nl80211_reg {
 	int	region;
 	char	country[3];
+	struct iw_nl80211_reg_rule rules[MAX_REG_RULES];
+	int	num_rules;
 };
 extern void iw_nl80211_getreg(struct iw_nl80211_reg *ir);
+extern void iw_nl80211_scan_getreg(struct iw_nl80211_reg *ir);
+
+/* Maximum number of channels retained in &iw_nl80211_freqs. */
+#define MAX_PHY_FREQS	256
+
+/**
+ * struct iw_nl80211_freqs - enabled channels of a PHY
+ * @freq: centre frequencies in MHz, in the order reported by the PHY
+ * @num:  number of valid entries in @freq
+ */
+struct iw_nl80211_freqs {
+	uint32_t	freq[MAX_PHY_FREQS];
+	size_t		num;
+};
+extern void iw_nl80211_get_freqs(struct iw_nl80211_freqs *fl);
+extern void iw_nl80211_get_ifindex_freqs(struct cmd *cmd, uint32_t ifindex, struct iw_nl80211_freqs *fl);
 extern void print_ssid_escaped(char *buf, const size_t buflen,
 			       const uint8_t *data, const size_t datalen);
 
@@ -248,11 +312,13 @@ extern void print_ssid_escaped(char *buf, const size_t buflen,
  * struct wait_event - wait for arrival of a specified message
  * @cmds:   array of GeNetlink commands (>0) to match
  * @n_cmds: length of @cmds
+ * @ifindex: only match messages about this interface (0: any interface)
  * @cmd:    matched element of @cmds (if message arrived), else 0
  */
 struct wait_event {
 	const uint32_t	*cmds;
 	uint8_t		n_cmds;
+	uint32_t	ifindex;
 	uint32_t	cmd;
 };
 extern struct nl_sock *alloc_nl_mcast_sk(const char *grp);
@@ -89,8 +89,17 @@ static int wait_event(struct nl_msg *msg, void *arg)
 {
 	struct wait_event *wait = arg;
 	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
 	int i;
 
+	if (wait->ifindex) {
+		nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+			  genlmsg_attrlen(gnlh, 0), NULL);
+		if (!tb[NL80211_ATTR_IFINDEX] ||
+		    nla_get_u32(tb[NL80211_ATTR_IFINDEX]) != wait->ifindex)
+			return NL_SKIP;
+	}
+
 	for (i = 0; i < wait->n_cmds; i++) {
 		if (gnlh->cmd == wait->cmds[i])
 			wait->cmd = gnlh->cmd;
@@ -99,26 +108,25 @@ static int wait_event(struct nl_msg *msg, void *arg)
 }
 
 /**
- * Wait for scan result notification sent by the kernel
+ * Wait on @sk for the scan result notification of interface @ifindex (0: any)
+ * sent by the kernel.
  * Returns true if scan results are available, false if scan was aborted.
  * Taken from iw:event.c:__do_listen_events
  */
-static bool wait_for_scan_events(void)
+static bool wait_for_scan_events(struct nl_sock *sk, uint32_t ifindex)
 {
 	static const uint32_t cmds[] = {
 		NL80211_CMD_NEW_SCAN_RESULTS,
 		NL80211_CMD_SCAN_ABORTED,
 	};
 	struct wait_event wait_ev = {
-		.cmds   = cmds,
-		.n_cmds = ARRAY_SIZE(cmds),
-		.cmd    = 0
+		.cmds    = cmds,
+		.n_cmds  = ARRAY_SIZE(cmds),
+		.ifindex = ifindex,
+		.cmd     = 0
 	};
 	struct nl_cb *cb;
 
-	if (!scan_wait_sk)
-		scan_wait_sk = alloc_nl_mcast_sk("scan");
-
 	cb = nl_cb_alloc(IW_NL_CB_DEBUG ? NL_CB_DEBUG : NL_CB_DEFAULT);
 	if (!cb)
 		err_sys("failed to allocate netlink callbacks");
@@ -128,20 +136,242 @@ static bool wait_for_scan_events(void)
 	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, wait_event, &wait_ev);
 
 	while (!wait_ev.cmd)
-		nl_recvmsgs(scan_wait_sk, cb);
+		nl_recvmsgs(sk, cb);
 	nl_cb_put(cb);
 
 	return wait_ev.cmd == NL80211_CMD_NEW_SCAN_RESULTS;
 }
 
+/*
+ *	Decoding of the occupied channel bandwidth.
+ */
+
+/* Centre frequency of channel number @ccfs, on the band of the primary channel of @e. */
+static uint16_t ccfs_to_freq(const struct scan_entry *e, uint8_t ccfs)
+{
+	return e->freq + 5 * (ccfs - e->chan);
+}
+
+/* Interpret VHT-style centre frequency segments @seg0/@seg1 of an 80+ MHz BSS. */
+static void set_chan_segments(struct scan_entry *e, uint8_t seg0, uint8_t seg1)
+{
+	e->chan_width = 80;
+	e->freq_ctr1  = ccfs_to_freq(e, seg0);
+	e->freq_ctr2  = 0;
+
+	if (seg1 && abs(seg1 - seg0) == 8) {
+		/* Contiguous 160 MHz: @seg1 is the centre of the whole channel. */
+		e->chan_width = 160;
+		e->freq_ctr1  = ccfs_to_freq(e, seg1);
+	} else if (seg1) {
+		/* 80+80 MHz: @seg1 is the centre of the secondary 80 MHz segment. */
+		e->freq_ctr2  = ccfs_to_freq(e, seg1);
+	}
+}
+
 /**
- * Scan result handler. Stolen from iw:scan.c
- * This also updates the scan-result statistics.
+ * Set the occupied bandwidth of @e from the bodies of the HT (@ht), VHT (@vht)
+ * and HE (@he, @he_len octets after the extension ID) operation elements,
+ * each of which may be NULL. Wider and newer information takes precedence.
  */
-static int scan_dump_handler(struct nl_msg *msg, void *arg)
+static void decode_chan_width(struct scan_entry *e, const uint8_t *ht,
+			      const uint8_t *vht, const uint8_t *he, int he_len)
 {
-	struct scan_result *sr = (struct scan_result *)arg;
-	struct scan_entry *new;
+	e->chan_width = 20;
+	e->freq_ctr1  = e->freq;
+	e->freq_ctr2  = 0;
+
+	/* 8.4.2.59: secondary channel offset, only if STA channel width is 'any'. */
+	if (ht && (ht[1] & 0x04)) {
+		if ((ht[1] & 0x03) == 1) {
+			e->chan_width = 40;
+			e->freq_ctr1  = e->freq + 10;
+		} else if ((ht[1] & 0x03) == 3) {
+			e->chan_width = 40;
+			e->freq_ctr1  = e->freq - 10;
+		}
+	}
+
+	/* 802.11-2016 9.4.2.159: 0 = 20/40 (use HT), 1 = 80/160/80+80, 2/3 = deprecated */
+	if (vht) {
+		if (vht[0] == 1 || vht[0] == 3) {
+			set_chan_segments(e, vht[1], vht[2]);
+		} else if (vht[0] == 2) {
+			e->chan_width = 160;
+			e->freq_ctr1  = ccfs_to_freq(e, vht[1]);
+		}
+	}
+
+	/* 802.11ax-2021 9.4.2.249: optional VHT and 6 GHz operation information. */
+	if (he && he_len >= 6) {
+		int off = 6;	/* HE operation parameters, BSS colour, basic HE-MCS */
+
+		if (he[1] & 0x40) {		/* VHT operation information present */
+			if (off + 3 <= he_len && in_range(he[off], 1, 3))
+				set_chan_segments(e, he[off + 1], he[off + 2]);
+			off += 3;
+		}
+		if (he[1] & 0x80)		/* co-hosted BSS */
+			off += 1;
+		if ((he[2] & 0x02) && off + 5 <= he_len) {
+			/* 6 GHz operation information: primary, control, CCFS0/1, min rate */
+			const uint8_t width = he[off + 1] & 0x03;
+
+			if (width == 3 && he[off + 3]) {
+				set_chan_segments(e, he[off + 2], he[off + 3]);
+			} else {
+				e->chan_width = 20 << width;
+				e->freq_ctr1  = ccfs_to_freq(e, he[off + 2]);
+				e->freq_ctr2  = 0;
+			}
+		}
+	}
+
+	/* Discard inconsistent information: the primary channel must be inside. */
+	if (abs(e->freq_ctr1 - (int)e->freq) >= e->chan_width / 2 &&
+	    (!e->freq_ctr2 || abs(e->freq_ctr2 - (int)e->freq) >= e->chan_width / 2)) {
+		e->chan_width = 20;
+		e->freq_ctr1  = e->freq;
+		e->freq_ctr2  = 0;
+	}
+}
+
+/*
+ *	Security elements
+ */
+
+/* Bit of the type of @suite (of the 802.11 or WPA OUI) in a suite mask. */
+static uint16_t suite_bit(const uint8_t *suite)
+{
+	static const uint8_t oui_ieee[3] = { 0x00, 0x0f, 0xac },
+			     oui_wpa[3]  = { 0x00, 0x50, 0xf2 };
+
+	if ((memcmp(suite, oui_ieee, 3) && memcmp(suite, oui_wpa, 3)) || suite[3] >= 15)
+		return SEC_SUITE_OTHER;
+	return 1 << suite[3];
+}
+
+/*
+ * Parse the pairwise cipher and AKM suite lists of the RSN element (802.11-2016
+ * 9.4.2.25) at @data into @e. The WPA vendor element has the same layout.
+ */
+static void parse_rsn(struct scan_entry *e, const uint8_t *data, int len)
+{
+	int n;
+
+	/* Version (2 octets) and group data cipher suite (4 octets). */
+	if (len < 8)
+		return;
+	n = data[6] | data[7] << 8;
+	for (data += 8, len -= 8; n > 0 && len >= 4; n--, data += 4, len -= 4)
+		e->sec_pairwise |= suite_bit(data);
+
+	if (n || len < 2)
+		return;
+	n = data[0] | data[1] << 8;
+	for (data += 2, len -= 2; n > 0 && len >= 4; n--, data += 4, len -= 4)
+		e->sec_akm |= suite_bit(data);
+}
+
+/*
+ *	Multiple BSSID (802.11-2020 9.4.2.45)
+ */
+
+/*
+ * Return @ref with its @n low-order bits advanced by @offset (modulo 2^n): the
+ * BSSID with index @offset of the transmitting BSS @ref, or with -@offset that of
+ * the transmitting BSS of the nontransmitted BSS @ref with index @offset.
+ */
+static struct ether_addr mbssid_addr(const struct ether_addr *ref, int offset, int n)
+{
+	const uint8_t mask = (1 << n) - 1;
+	struct ether_addr addr = *ref;
+
+	addr.ether_addr_octet[5] = (ref->ether_addr_octet[5] & ~mask) |
+				   ((ref->ether_addr_octet[5] + offset) & mask);
+	return addr;
+}
+
+/*
+ * Append the Nontransmitted BSSID Profile subelements of the Multiple BSSID
+ * element of @tx (body after the MaxBSSID Indicator at @data) to @sr.
+ */
+static void parse_mbssid(struct scan_result *sr, const struct scan_entry *tx,
+			 const uint8_t *data, int len)
+{
+	for (; len >= 2 && len >= data[1] + 2; len -= data[1] + 2, data += data[1] + 2) {
+		const uint8_t *el = data + 2;
+		int ellen = data[1];
+		struct mbssid_profile prof = { .capa = tx->bss_capa };
+
+		if (data[0] != 0)	/* not a Nontransmitted BSSID Profile */
+			continue;
+
+		for (; ellen >= 2 && ellen >= el[1] + 2; ellen -= el[1] + 2, el += el[1] + 2) {
+			if (el[0] == IE_SSID && el[1] > 0 && el[1] <= 32)
+				print_ssid_escaped(prof.essid, sizeof(prof.essid), el + 2, el[1]);
+			else if (el[0] == IE_NON_TRANSM_BSSID && el[1] >= 2)
+				prof.capa = el[2] | el[3] << 8;
+			else if (el[0] == IE_MULTI_BSSID_IDX && el[1] >= 1)
+				prof.index = el[2];
+		}
+		/* Profiles split over several elements carry the index in the first part only. */
+		if (!prof.index || prof.index >= 1 << tx->mbssid_max)
+			continue;
+
+		prof.addr    = mbssid_addr(&tx->ap_addr, prof.index, tx->mbssid_max);
+		prof.tx_addr = tx->ap_addr;
+		prof.freq    = tx->freq;
+
+		/* Grow in powers of 2. */
+		if (!(sr->num.mbssid & (sr->num.mbssid - 1))) {
+			sr->mbssid = realloc(sr->mbssid, (sr->num.mbssid ? 2 * sr->num.mbssid : 1) *
+						      sizeof(*sr->mbssid));
+			if (!sr->mbssid)
+				err_sys("unable to allocate Multiple BSSID profile");
+		}
+		sr->mbssid[sr->num.mbssid++] = prof;
+	}
+}
+
+/** Prepend @new to the list of @sr, and update the scan-result statistics. */
+static void add_scan_entry(struct scan_result *sr, struct scan_entry *new)
+{
+	new->next = sr->head;
+	sr->head  = new;
+
+	if (!*new->essid) {
+		sr->num.hidden++;
+	} else if (str_is_ascii(new->essid)) {
+		sr->max_essid_len = clamp(strlen(new->essid),
+					  sr->max_essid_len,
+					  MAX_ESSID_LEN);
+	}
+
+	if (new->freq > 45000)	/* 802.11ad 60GHz spectrum */
+		err_quit("FIXME: can not handle %d MHz spectrum yet", new->freq);
+	else if (new->freq >= 5000)
+		sr->num.five_gig++;
+	else if (new->freq >= 2000)
+		sr->num.two_gig++;
+	sr->num.entries += 1;
+	sr->num.open    += !new->has_key;
+
+	/* Precompute filter properties, so that filtering does not need to re-parse. */
+	new->filter_bits = (new->freq < 2500 ? SF_BAND_2G : SF_BAND_5G) |
+			   (new->has_key ? 0 : SF_OPEN) |
+			   (*new->essid ? 0 : SF_HIDDEN);
+}
+
+/**
+ * Parse the BSS of scan-dump message @msg into @new (zero-initialised by the caller).
+ * Unless @sr is NULL, the nontransmitted BSSes announced by @new are appended to it.
+ * Returns false if @msg does not describe a BSS. Stolen from iw:scan.c
+ */
+static bool parse_scan_entry(struct nl_msg *msg, struct scan_entry *new, struct scan_result *sr)
+{
+	const uint8_t *ht_op = NULL, *vht_op = NULL, *he_op = NULL;
+	int he_op_len = 0;
 	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
 	struct nlattr *tb[NL80211_ATTR_MAX + 1];
 	struct nlattr *bss[NL80211_BSS_MAX + 1];
@@ -157,35 +387,22 @@ static int scan_dump_handler(struct nl_msg *msg, void *arg)
 		[NL80211_BSS_STATUS]               = { .type = NLA_U32 },
 		[NL80211_BSS_SEEN_MS_AGO]          = { .type = NLA_U32 },
 		[NL80211_BSS_BEACON_IES]           = { 0 },
+		[NL80211_BSS_PRESP_DATA]           = { .type = NLA_FLAG },
 	};
 
 	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
 		  genlmsg_attrlen(gnlh, 0), NULL);
 
 	if (!tb[NL80211_ATTR_BSS])
-		return NL_SKIP;
+		return false;
 
 	if (nla_parse_nested(bss, NL80211_BSS_MAX,
 			     tb[NL80211_ATTR_BSS],
 			     bss_policy))
-		return NL_SKIP;
+		return false;
 
 	if (!bss[NL80211_BSS_BSSID])
-		return NL_SKIP;
-
-	/* Band filtering */
-	if (bss[NL80211_BSS_FREQUENCY] && conf.scan_filter_band != SCAN_FILTER_BAND_BOTH) {
-		uint32_t freq = nla_get_u32(bss[NL80211_BSS_FREQUENCY]);
-
-		if (conf.scan_filter_band == SCAN_FILTER_BAND_2G && freq > 2500)
-			return NL_SKIP;
-		if (conf.scan_filter_band == SCAN_FILTER_BAND_5G && freq < 2500)
-			return NL_SKIP;
-	}
-
-	new = calloc(1, sizeof(*new));
-	if (!new)
-		err_sys("failed to allocate scan entry");
+		return false;
 
 	memcpy(&new->ap_addr, nla_data(bss[NL80211_BSS_BSSID]), sizeof(new->ap_addr));
 
@@ -232,14 +449,52 @@ static int scan_dump_handler(struct nl_msg *msg, void *arg)
 				if (len >= 5) {
 					new->bss_sta_count  = ie[3] << 8 | ie[2];
 					new->bss_chan_usage = ie[4];
+					new->has_bss_load   = true;
 				}
 				break;
 			case IE_HT_CAPABILITIES:
 				new->ht_capable = true;
 				break;
+			case IE_HT_OPERATION:
+				if (len >= 2)
+					ht_op = ie + 2;
+				break;
+			case IE_VHT_OPERATION:
+				if (len >= 3)
+					vht_op = ie + 2;
+				break;
+			case IE_EXTENSION:
+				if (len >= 1 && ie[2] == IE_EXT_HE_OPERATION) {
+					he_op     = ie + 3;
+					he_op_len = len - 1;
+				}
+				break;
 			case IE_RM_CAPABILITIES:
 				new->rm_enabled = true;
 				break;
+			case IE_MULTIPLE_BSSID:
+				if (len >= 1 && in_range(ie[2], 1, 8)) {
+					new->mbssid_max = ie[2];
+					if (sr)
+						parse_mbssid(sr, new, ie + 3, len - 1);
+				}
+				break;
+			case IE_MULTI_BSSID_IDX:
+				if (len >= 1)
+					new->mbssid_index = ie[2];
+				break;
+			case IE_RSN:
+				new->sec_proto |= SEC_PROTO_RSN;
+				parse_rsn(new, ie + 2, len);
+				break;
+			case IE_VENDOR_SPECIFIC:
+				/* WPA: Microsoft OUI 00-50-F2, type 1 */
+				if (len >= 4 && ie[2] == 0x00 && ie[3] == 0x50 && ie[4] == 0xf2 &&
+				    ie[5] == 1) {
+					new->sec_proto |= SEC_PROTO_WPA;
+					parse_rsn(new, ie + 6, len - 4);
+				}
+				break;
 			case IE_MESH_CONFIG:
 				new->mesh_enabled = true;
 				break;
@@ -251,247 +506,1846 @@ static int scan_dump_handler(struct nl_msg *msg, void *arg)
 		}
 	}
 
-	/* Update stats */
-	new->next = sr->head;
-	sr->head  = new;
-
-	if (!*new->essid) {
-		sr->num.hidden++;
-	} else if (str_is_ascii(new->essid)) {
-		sr->max_essid_len = clamp(strlen(new->essid),
-					  sr->max_essid_len,
-					  MAX_ESSID_LEN);
+	/*
+	 * Hidden ESSIDs: beacons carry an empty or zeroed SSID, whereas the IEs
+	 * above may come from a probe response (PRESP_DATA) that has the real one.
+	 */
+	if (bss[NL80211_BSS_BEACON_IES]) {
+		const uint8_t *ie = nla_data(bss[NL80211_BSS_BEACON_IES]);
+		int ielen         = nla_len(bss[NL80211_BSS_BEACON_IES]);
+		char beacon_essid[sizeof(new->essid)] = "";
+
+		for (; ielen >= 2 && ielen >= ie[1] + 2; ielen -= ie[1] + 2, ie += ie[1] + 2)
+			if (ie[0] == IE_SSID) {
+				if (ie[1] > 0 && ie[1] <= 32)
+					print_ssid_escaped(beacon_essid, sizeof(beacon_essid),
+							   ie + 2, ie[1]);
+				break;
+			}
+		new->essid_hidden = !*beacon_essid;
+		if (!*new->essid)
+			memcpy(new->essid, beacon_essid, sizeof(new->essid));
+	} else if (!bss[NL80211_BSS_PRESP_DATA]) {
+		/* The IEs are those of a beacon. */
+		new->essid_hidden = !*new->essid;
 	}
 
-	if (new->freq > 45000)	/* 802.11ad 60GHz spectrum */
-		err_quit("FIXME: can not handle %d MHz spectrum yet", new->freq);
-	else if (new->freq >= 5000)
-		sr->num.five_gig++;
-	else if (new->freq >= 2000)
-		sr->num.two_gig++;
-	sr->num.entries += 1;
-	sr->num.open    += !new->has_key;
+	if (new->chan > 0)
+		decode_chan_width(new, ht_op, vht_op, he_op, he_op_len);
 
-	return NL_SKIP;
+	/* 802.11ax-2021 9.4.2.249: BSS colour information follows the 3 parameter octets. */
+	if (he_op && he_op_len >= 4) {
+		new->bss_color          = he_op[3] & 0x3f;
+		new->bss_color_disabled = (he_op[3] & 0x80) != 0;
+	}
+
+	return true;
 }
 
-static int iw_nl80211_scan_trigger(void)
-{
-	static struct cmd cmd_trigger_scan = {
-		.cmd = NL80211_CMD_TRIGGER_SCAN,
-	};
+/*
+ * Index of the entries of a scan by BSSID and frequency (a BSSID may be reused
+ * on different bands), chained via index + 1 as in compute_color_collisions().
+ */
+struct bss_index {
+	struct scan_entry	**entry;
+	uint32_t		*hnext,
+				*buckets;
+	size_t			nbuckets,
+				n;
+};
 
-	return handle_interface_cmd(&cmd_trigger_scan);
+static uint32_t *bss_index_bucket(struct bss_index *bi, const struct ether_addr *addr, uint32_t freq)
+{
+	return &bi->buckets[(hash_fnv1a(addr, sizeof(*addr)) ^ freq) & (bi->nbuckets - 1)];
 }
 
-static int iw_nl80211_get_scan_data(struct scan_result *sr)
+static void bss_index_add(struct bss_index *bi, struct scan_entry *e)
 {
-	static struct cmd cmd_scan_dump = {
-		.cmd	 = NL80211_CMD_GET_SCAN,
-		.flags	 = NLM_F_DUMP,
-		.handler = scan_dump_handler
-	};
+	uint32_t *b = bss_index_bucket(bi, &e->ap_addr, e->freq);
 
-	sr->max_essid_len = MAX_ESSID_LEN;
-	cmd_scan_dump.handler_arg = sr;
+	bi->entry[bi->n] = e;
+	bi->hnext[bi->n] = *b;
+	*b = ++bi->n;
+}
 
-	return handle_interface_cmd(&cmd_scan_dump);
+static struct scan_entry *bss_index_find(struct bss_index *bi, const struct ether_addr *addr, uint32_t freq)
+{
+	for (uint32_t idx = *bss_index_bucket(bi, addr, freq); idx; idx = bi->hnext[idx - 1])
+		if (bi->entry[idx - 1]->freq == freq &&
+		    !memcmp(&bi->entry[idx - 1]->ap_addr, addr, sizeof(*addr)))
+			return bi->entry[idx - 1];
+	return NULL;
 }
 
-/*
- * Simple sort routine.
- * FIXME: use hash or tree to store entries, a list to display them.
+/**
+ * Add the nontransmitted BSSes of the Multiple BSSID profiles of @sr that the
+ * kernel has not listed itself (it does so since Linux 5.1), then link every
+ * nontransmitted BSS to its transmitting BSS, looked up by transmitter address.
+ * Counts the physical access points, and consumes the profiles.
  */
-void sort_scan_list(struct scan_entry **headp)
+static void expand_mbssid(struct scan_result *sr)
 {
-	struct scan_entry *head = NULL, *cur, *new = *headp, **prev;
+	struct bss_index bi = { .n = 0 };
+	struct scan_entry *cur, *tx;
+	size_t max_n = sr->num.entries + sr->num.mbssid, linked = 0;
 
-	while (new) {
-		for (cur = head, prev = &head; cur &&
-		     conf.scan_sort_asc == scan_cmp[conf.scan_sort_order](cur, new);
-		     prev = &cur->next, cur = cur->next)
-			;
-		*prev = new;
-		new = new->next;
-		(*prev)->next = cur;
+	if (!max_n)
+		return;
+
+	bi.nbuckets = roundup_pow2(max_n);
+	bi.buckets  = calloc(bi.nbuckets, sizeof(*bi.buckets));
+	bi.hnext    = calloc(max_n, sizeof(*bi.hnext));
+	bi.entry    = calloc(max_n, sizeof(*bi.entry));
+	if (!bi.buckets || !bi.hnext || !bi.entry)
+		err_sys("unable to allocate BSSID index");
+	for (cur = sr->head; cur; cur = cur->next)
+		bss_index_add(&bi, cur);
+
+	for (size_t i = 0; i < sr->num.mbssid; i++) {
+		const struct mbssid_profile *prof = sr->mbssid + i;
+
+		if (bss_index_find(&bi, &prof->addr, prof->freq))
+			continue;
+		tx = bss_index_find(&bi, &prof->tx_addr, prof->freq);
+		if (!tx)
+			continue;
+
+		/* Other than ESSID and capabilities, a profile inherits from the transmitting BSS. */
+		cur = malloc(sizeof(*cur));
+		if (!cur)
+			err_sys("failed to allocate scan entry");
+		*cur = *tx;
+		cur->ap_addr      = prof->addr;
+		cur->bss_capa     = prof->capa;
+		cur->has_key      = (prof->capa & WLAN_CAPABILITY_PRIVACY) != 0;
+		cur->essid_hidden = !*prof->essid;
+		cur->essid_cached = false;
+		cur->mbssid_max   = 0;
+		cur->mbssid_index = prof->index;
+		cur->mbssid_synth = true;
+		memcpy(cur->essid, prof->essid, sizeof(cur->essid));
+		add_scan_entry(sr, cur);
+		bss_index_add(&bi, cur);
 	}
-	*headp = head;
-}
+	free(sr->mbssid);
+	sr->mbssid     = NULL;
+	sr->num.mbssid = 0;
 
-static void free_scan_list(struct scan_entry *head)
-{
-	if (head) {
-		free_scan_list(head->next);
-		free(head);
+	/* The MaxBSSID Indicator is only known from the transmitting BSS, so try each. */
+	for (cur = sr->head; cur; cur = cur->next) {
+		for (int n = 1; cur->mbssid_index && n <= 8; n++) {
+			struct ether_addr tx_addr;
+
+			if (cur->mbssid_index >= 1 << n)
+				continue;
+			tx_addr = mbssid_addr(&cur->ap_addr, -cur->mbssid_index, n);
+			tx = bss_index_find(&bi, &tx_addr, cur->freq);
+			if (tx && tx != cur && tx->mbssid_max == n) {
+				cur->mbssid_tx = tx;
+				tx->mbssid_count++;
+				linked++;
+				break;
+			}
+		}
 	}
-}
+	sr->num.physical = sr->num.entries - linked;
 
-/*
- * 	Channel statistics shown at the bottom of scan screen.
- */
+	free(bi.entry);
+	free(bi.hnext);
+	free(bi.buckets);
+}
 
-/*
- * For lsearch, it compares key value with array member, needs to
- * return 0 if they are the same, non-0 otherwise.
+/**
+ * Fill in hidden ESSIDs that are known from earlier scans, and remember those
+ * of this scan. Updates the counts of hidden ESSIDs accordingly.
  */
-static int cmp_key(const void *a, const void *b)
+static void resolve_hidden_essids(struct scan_result *sr)
 {
-	return ((struct cnt *)a)->val - ((struct cnt *)b)->val;
+	for (struct scan_entry *cur = sr->head; cur; cur = cur->next) {
+		if (bss_resolve_essid(cur)) {
+			sr->num.hidden--;
+			cur->filter_bits &= ~SF_HIDDEN;
+		}
+		if (cur->essid_hidden && *cur->essid)
+			sr->num.unveiled++;
+	}
 }
 
-/* For quick-sorting the array in descending order of counts */
-static int cmp_cnt(const void *a, const void *b)
-{
-	if (conf.scan_sort_order == SO_CHAN && !conf.scan_sort_asc)
-		return ((struct cnt *)a)->count - ((struct cnt *)b)->count;
-	return ((struct cnt *)b)->count - ((struct cnt *)a)->count;
-}
+/* Number of the current scan round, as the evil-twin profiles count scans. */
+static uint32_t twin_scan = 1;
 
 /**
- * Fill in sr->channel_stats (must not have been allocated yet).
+ * Check the entries of @sr against what is known about their ESSIDs, counting
+ * the suspects, and adding an event for each BSS that has only now been flagged.
+ * All sweeps of a round count as one scan (see round_end()), so that the first
+ * profile of an ESSID includes all bands.
  */
-static void compute_channel_stats(struct scan_result *sr)
+static void check_evil_twins(struct scan_result *sr)
 {
-	struct scan_entry *cur;
-	struct cnt *bin, key = {0, 0};
-	size_t n = 0;
-
-	if (!sr->num.entries)
-		return;
-
-	sr->channel_stats = calloc(sr->num.entries, sizeof(key));
-	for (cur = sr->head; cur; cur = cur->next) {
-		if (cur->chan >= 0) {
-			key.val = cur->chan;
-			bin = lsearch(&key, sr->channel_stats, &n, sizeof(key), cmp_key);
-			if (bin)
-				bin->count++;
+	struct scan_event ev;
+
+	for (struct scan_entry *cur = sr->head; cur; cur = cur->next) {
+		if (twin_check(cur, twin_scan)) {
+			ev.time       = time(NULL);
+			ev.addr       = cur->ap_addr;
+			ev.twin_flags = cur->twin_flags;
+			memcpy(ev.essid, cur->essid, sizeof(ev.essid));
+			scan_event_push(&sr->events, &ev);
 		}
+		if (cur->twin_flags)
+			sr->num.twins++;
 	}
+}
 
-	if (n > 0) {
-		qsort(sr->channel_stats, n, sizeof(key), cmp_cnt);
-	} else {
-		free(sr->channel_stats);
-		sr->channel_stats = NULL;
+/**
+ * Check the BSSIDs of @sr against those seen at this site before, counting the
+ * new ones, and adding an event for each BSS that has only now been found new.
+ * The baseline lasts until the end of the first round (see round_end()).
+ */
+static void check_new_bsses(struct scan_result *sr)
+{
+	struct scan_event ev = { .twin_flags = 0 };
+
+	for (struct scan_entry *cur = sr->head; cur; cur = cur->next) {
+		if (seen_filter_check(cur)) {
+			ev.time = time(NULL);
+			ev.addr = cur->ap_addr;
+			memcpy(ev.essid, cur->essid, sizeof(ev.essid));
+			scan_event_push(&sr->events, &ev);
+		}
+		if (cur->new_bss)
+			sr->num.new_bss++;
 	}
-	sr->num.ch_stats = n < MAX_CH_STATS ? n : MAX_CH_STATS;
 }
 
 /*
- *	Scan results.
+ * Conclude a round of sweeps, whether or not all of them succeeded: later
+ * sweeps are checked against the twin profiles and BSSID baseline of this one.
  */
-static void _clear_scan_result(struct scan_result *sr)
+static void round_end(void)
 {
-	free_scan_list(sr->head);
-	free(sr->channel_stats);
-
-	sr->head          = NULL;
-	sr->channel_stats = NULL;
-	sr->msg[0]        = '\0';
-	memset(&(sr->num), 0, sizeof(sr->num));
+	twin_scan++;
+	seen_filter_sync(false);
 }
 
-static void _write_warning_msg(struct scan_result *sr, const char *format, ...)
+/**
+ * Scan result handler.
+ * This also updates the scan-result statistics.
+ */
+static int scan_dump_handler(struct nl_msg *msg, void *arg)
 {
-	va_list argp;
+	struct scan_result *sr = (struct scan_result *)arg;
+	const uint64_t start = prof_now();
+	struct scan_entry *new = calloc(1, sizeof(*new));
+
+	if (!new)
+		err_sys("failed to allocate scan entry");
+
+	if (parse_scan_entry(msg, new, sr))
+		add_scan_entry(sr, new);
+	else
+		free(new);
+	sr->timing.parse_ns += prof_now() - start;
+	return NL_SKIP;
+}
+
+/*
+ *	Progressive scans: one band at a time.
+ */
+/**
+ * struct scan_band - channels of one band, as scanned by one trigger
+ * @name:  band name
+ * @attrs: the NL80211_ATTR_SCAN_FREQUENCIES payload, one u32 attribute per channel
+ * @len:   size of @attrs in bytes
+ */
+struct scan_band {
+	const char	*name;
+	struct scan_freq_attr {
+		struct nlattr	nla;
+		uint32_t	freq;
+	}		*attrs;
+	size_t		len;
+};
+
+/* Bands in the order swept, 2.4 GHz first: it has the fewest channels. */
+static struct scan_band scan_bands[] = {
+	{ .name = "2.4 GHz" },
+	{ .name = "5 GHz" },
+	{ .name = "6 GHz" },
+};
+static size_t num_scan_bands;
+
+static int freq_band(uint32_t freq)
+{
+	return freq < 2500 ? 0 : freq < 5950 ? 1 : 2;
+}
+
+static void band_add_freq(struct scan_band *sb, uint32_t freq)
+{
+	const size_t n = sb->len / sizeof(*sb->attrs);
+
+	sb->attrs = realloc(sb->attrs, (n + 1) * sizeof(*sb->attrs));
+	if (!sb->attrs)
+		err_sys("unable to allocate scan frequencies");
+	sb->attrs[n].nla.nla_len  = sizeof(*sb->attrs);
+	sb->attrs[n].nla.nla_type = n + 1;
+	sb->attrs[n].freq         = freq;
+	sb->len += sizeof(*sb->attrs);
+}
+
+static void band_clear(struct scan_band *sb)
+{
+	free(sb->attrs);
+	sb->attrs = NULL;
+	sb->len   = 0;
+}
+
+/*
+ * Trigger a scan of the channels of @band, or of all channels if NULL. With
+ * @low_prio, the driver may hold back the scan in favour of traffic.
+ */
+static int iw_nl80211_scan_trigger(const struct scan_band *band, bool low_prio)
+{
+	static const uint32_t low_prio_flags = NL80211_SCAN_FLAG_LOW_PRIORITY;
+	static struct cmd cmd_trigger_scan = {
+		.cmd = NL80211_CMD_TRIGGER_SCAN,
+	};
+
+	if (band)
+		add_msg_arg(&cmd_trigger_scan, NL80211_ATTR_SCAN_FREQUENCIES | NLA_F_NESTED,
+			    band->len, band->attrs);
+	if (low_prio)
+		add_msg_arg(&cmd_trigger_scan, NL80211_ATTR_SCAN_FLAGS,
+			    sizeof(low_prio_flags), &low_prio_flags);
+	return handle_interface_cmd(&cmd_trigger_scan);
+}
+
+static int iw_nl80211_get_scan_data(struct scan_result *sr)
+{
+	static struct cmd cmd_scan_dump = {
+		.cmd	 = NL80211_CMD_GET_SCAN,
+		.flags	 = NLM_F_DUMP,
+		.handler = scan_dump_handler
+	};
+
+	sr->max_essid_len = MAX_ESSID_LEN;
+	cmd_scan_dump.handler_arg = sr;
+
+	return handle_interface_cmd(&cmd_scan_dump);
+}
+
+/*
+ *	One-shot scans, passed on entry by entry instead of building a scan list.
+ */
+struct scan_stream {
+	scan_sink_t		sink;
+	void			*arg;
+	struct scan_timing	*timing;
+	uint32_t		scan;
+};
+
+static int stream_dump_handler(struct nl_msg *msg, void *arg)
+{
+	struct scan_stream *st = arg;
+	const uint64_t start = prof_now();
+	struct scan_entry e;
+	bool ok;
+
+	memset(&e, 0, sizeof(e));
+	ok = parse_scan_entry(msg, &e, NULL);
+	st->timing->parse_ns += prof_now() - start;
+	if (ok) {
+		bss_resolve_essid(&e);
+		twin_check(&e, st->scan);
+		seen_filter_check(&e);
+		st->sink(&e, st->arg);
+	}
+	return NL_SKIP;
+}
+
+/**
+ * Run one scan on the default interface, and pass each BSS of the results to
+ * @sink (together with @arg) as soon as it has been parsed. Fills in the
+ * trigger, firmware, dump and parsing times of @t (the dump includes @sink).
+ * Returns 0 if ok, -ECANCELED if the scan was aborted, other -errno < 0 on failure.
+ */
+int scan_stream(scan_sink_t sink, void *arg, struct scan_timing *t)
+{
+	uint64_t lap;
+	int ret;
+
+	/* Subscribe before triggering, so that the result notification is not missed. */
+	if (!scan_wait_sk)
+		scan_wait_sk = alloc_nl_mcast_sk("scan");
+
+	memset(t, 0, sizeof(*t));
+	lap = prof_now();
+	ret = iw_nl80211_scan_trigger(NULL, false);
+	t->v[SP_TRIGGER] = prof_lap(&lap);
+	if (ret < 0 && ret != -EBUSY)
+		return ret;
+	if (!wait_for_scan_events(scan_wait_sk, if_nametoindex(conf_ifname())))
+		return -ECANCELED;
+	t->v[SP_FIRMWARE] = prof_lap(&lap);
+
+	return scan_stream_cached(sink, arg, t);
+}
+
+/**
+ * Like scan_stream(), but without scanning: pass on the BSSes that the kernel
+ * still holds from earlier scans (e.g. while a new scan can not be triggered).
+ * Only fills in the dump and parsing times of @t.
+ */
+int scan_stream_cached(scan_sink_t sink, void *arg, struct scan_timing *t)
+{
+	static struct cmd cmd_stream_dump = {
+		.cmd	 = NL80211_CMD_GET_SCAN,
+		.flags	 = NLM_F_DUMP,
+		.handler = stream_dump_handler
+	};
+	static uint32_t scan;
+	struct scan_stream st = { .sink = sink, .arg = arg, .timing = t, .scan = ++scan };
+	uint64_t lap = prof_now();
+	int ret;
+
+	t->parse_ns = 0;
+	cmd_stream_dump.handler_arg = &st;
+	ret = handle_interface_cmd(&cmd_stream_dump);
+	t->v[SP_DUMP] = prof_lap(&lap);
+	if (ret < 0)
+		return ret;
+	seen_filter_sync(false);
+	return 0;
+}
+
+/*
+ * Simple sort routine.
+ * FIXME: use hash or tree to store entries, a list to display them.
+ */
+void sort_scan_list(struct scan_entry **headp)
+{
+	struct scan_entry *head = NULL, *cur, *new = *headp, **prev;
+
+	while (new) {
+		for (cur = head, prev = &head; cur &&
+		     conf.scan_sort_asc == scan_cmp[conf.scan_sort_order](cur, new);
+		     prev = &cur->next, cur = cur->next)
+			;
+		*prev = new;
+		new = new->next;
+		(*prev)->next = cur;
+	}
+	*headp = head;
+}
+
+static void free_scan_list(struct scan_entry *head)
+{
+	if (head) {
+		free_scan_list(head->next);
+		free(head);
+	}
+}
+
+/*
+ *	Multi-radio scanning
+ */
+
+/* Readings of one BSS by several radios that are this close in time count as simultaneous. */
+#define RADIO_MERGE_AGE_MS	1000
+
+/**
+ * struct radio - additional interface that scans in parallel to the default one
+ * @ifname:  interface name
+ * @ifindex: interface index
+ * @phy_id:  index of the PHY that @ifname belongs to
+ * @cmd:     commands of this radio (each radio uses its own netlink socket)
+ * @wait_sk: scan-event socket of this radio
+ * @share:   channels that this radio sweeps (all if none, see radios_split())
+ * @idle:    whether all bands of this radio are swept by others
+ * @thread:  worker collecting the scan results of one round
+ * @running: whether @thread has been started, but not joined yet
+ * @res:     scan results of the current round
+ */
+struct radio {
+	char			*ifname;
+	uint32_t		ifindex,
+				phy_id;
+	struct cmd		cmd;
+	struct nl_sock		*wait_sk;
+	struct scan_band	share;
+	bool			idle;
+	pthread_t		thread;
+	bool			running;
+	struct scan_result	res;
+};
+static struct radio *radios;
+static size_t num_radios, radios_running;
+
+static void radios_fini(void)
+{
+	for (size_t i = 0; i < num_radios; i++) {
+		free(radios[i].ifname);
+		band_clear(&radios[i].share);
+		nl_socket_free(radios[i].cmd.sk);
+		nl_socket_free(radios[i].wait_sk);
+	}
+	free(radios);
+	radios     = NULL;
+	num_radios = 0;
+}
+
+/**
+ * Set up one radio for each wireless PHY other than that of the default interface
+ * (several interfaces of one PHY share its radio, so scanning on them gains nothing).
+ */
+static void radios_init(void)
+{
+	struct interface_info *head = NULL, *cur, *def = NULL;
+	size_t i;
+
+	radios_fini();
+	if (conf.scan_radios != SCAN_RADIOS_ALL)
+		return;
+
+	iw_nl80211_get_interface_list(&head);
+	for (cur = head; cur; cur = cur->next)
+		if (!strcmp(cur->ifname, conf_ifname()))
+			def = cur;
+
+	radios = calloc(count_interface_list(head) + 1, sizeof(*radios));
+	if (!radios)
+		err_sys("unable to allocate radios");
+
+	for (cur = head; cur; cur = cur->next) {
+		if (def && cur->phy_id == def->phy_id)
+			continue;
+		for (i = 0; i < num_radios && radios[i].phy_id != cur->phy_id; i++)
+			;
+		if (i < num_radios)
+			continue;
+
+		radios[num_radios].ifname  = strdup(cur->ifname);
+		radios[num_radios].ifindex = cur->ifindex;
+		radios[num_radios].phy_id  = cur->phy_id;
+		/* Subscribe before the first trigger, so that no event is missed. */
+		radios[num_radios].wait_sk = alloc_nl_mcast_sk("scan");
+		num_radios++;
+	}
+	free_interface_list(head);
+}
+
+/* Worker: trigger a scan on one radio, and collect its results. */
+static void *radio_scan(void *arg)
+{
+	struct radio *r = arg;
+	int ret;
+
+	if (r->idle)
+		return NULL;
+	r->cmd.cmd     = NL80211_CMD_TRIGGER_SCAN;
+	r->cmd.flags   = 0;
+	r->cmd.handler = NULL;
+	if (r->share.len)
+		add_msg_arg(&r->cmd, NL80211_ATTR_SCAN_FREQUENCIES | NLA_F_NESTED,
+			    r->share.len, r->share.attrs);
+	ret = handle_ifindex_cmd(&r->cmd, r->ifindex);
+
+	/* A radio that is down, blocked, or failing just does not contribute. */
+	if ((ret == 0 || ret == -EBUSY) && wait_for_scan_events(r->wait_sk, r->ifindex)) {
+		r->cmd.cmd         = NL80211_CMD_GET_SCAN;
+		r->cmd.flags       = NLM_F_DUMP;
+		r->cmd.handler     = scan_dump_handler;
+		r->cmd.handler_arg = &r->res;
+		r->res.max_essid_len = MAX_ESSID_LEN;
+		handle_ifindex_cmd(&r->cmd, r->ifindex);
+	}
+	return NULL;
+}
+
+/* Start one round of scans on all radios. */
+static void radios_start(void)
+{
+	for (radios_running = 0; radios_running < num_radios; radios_running++) {
+		memset(&radios[radios_running].res, 0, sizeof(radios[radios_running].res));
+		if (pthread_create(&radios[radios_running].thread, NULL, radio_scan,
+				   radios + radios_running))
+			err_sys("can not start scan on %s", radios[radios_running].ifname);
+		radios[radios_running].running = true;
+	}
+}
+
+/* Abort the current round (also used as cleanup handler of the scan thread). */
+static void radios_cancel(void *arg)
+{
+	(void)arg;
+	for (size_t i = 0; i < radios_running; i++) {
+		if (radios[i].running) {
+			pthread_cancel(radios[i].thread);
+			pthread_join(radios[i].thread, NULL);
+			radios[i].running = false;
+		}
+		free_scan_list(radios[i].res.head);
+		free(radios[i].res.mbssid);
+		radios[i].res.head   = NULL;
+		radios[i].res.mbssid = NULL;
+	}
+	radios_running = 0;
+}
+
+/* Order by BSSID, then most recent reading first. */
+static int cmp_bssid_age(const void *a, const void *b)
+{
+	const struct scan_entry *ea = *(struct scan_entry * const *)a;
+	const struct scan_entry *eb = *(struct scan_entry * const *)b;
+	int d = memcmp(&ea->ap_addr, &eb->ap_addr, sizeof(ea->ap_addr));
+
+	return d ? d : (ea->last_seen > eb->last_seen) - (ea->last_seen < eb->last_seen);
+}
+
+/* Signal level of @e for comparison (unknown levels rank last). */
+static int merge_signal(const struct scan_entry *e)
+{
+	return e->bss_signal ? e->bss_signal : INT8_MIN;
+}
+
+/**
+ * Wait for the current round of radio scans to finish, and merge the results
+ * into @sr (NULL to discard them). Of the readings of one BSSID, the strongest
+ * one taken within %RADIO_MERGE_AGE_MS of the most recent one is kept.
+ */
+static void radios_join(struct scan_result *sr)
+{
+	struct scan_entry **v = NULL, *cur, *best;
+	size_t n, i, j, k, contributed = 1, num_mbssid = sr ? sr->num.mbssid : 0;
+
+	for (k = 0; k < radios_running; k++) {
+		pthread_join(radios[k].thread, NULL);
+		radios[k].running = false;
+	}
+
+	if (!sr || !radios_running) {
+		radios_cancel(NULL);
+		return;
+	}
+
+	for (n = sr->num.entries, k = 0; k < radios_running; k++)
+		n += radios[k].res.num.entries;
+	v = malloc(n * sizeof(*v));
+	if (n && !v)
+		err_sys("unable to merge scan results");
+
+	for (n = 0, cur = sr->head; cur; cur = cur->next)
+		v[n++] = cur;
+	for (k = 0; k < radios_running; k++) {
+		contributed += radios[k].res.head != NULL;
+		for (cur = radios[k].res.head; cur; cur = cur->next)
+			v[n++] = cur;
+		radios[k].res.head = NULL;
+
+		if (radios[k].res.num.mbssid) {
+			sr->mbssid = realloc(sr->mbssid, (num_mbssid + radios[k].res.num.mbssid) *
+							 sizeof(*sr->mbssid));
+			if (!sr->mbssid)
+				err_sys("unable to merge Multiple BSSID profiles");
+			memcpy(sr->mbssid + num_mbssid, radios[k].res.mbssid,
+			       radios[k].res.num.mbssid * sizeof(*sr->mbssid));
+			num_mbssid += radios[k].res.num.mbssid;
+		}
+		free(radios[k].res.mbssid);
+		radios[k].res.mbssid = NULL;
+	}
+	radios_running = 0;
+	qsort(v, n, sizeof(*v), cmp_bssid_age);
+
+	sr->head = NULL;
+	memset(&sr->num, 0, sizeof(sr->num));
+	sr->num.radios = contributed;
+	sr->num.mbssid = num_mbssid;
+
+	for (i = 0; i < n; i = j) {
+		best = v[i];
+		for (j = i + 1; j < n && !memcmp(&v[j]->ap_addr, &v[i]->ap_addr, sizeof(v[i]->ap_addr)); j++)
+			if (v[j]->last_seen <= v[i]->last_seen + RADIO_MERGE_AGE_MS &&
+			    merge_signal(v[j]) > merge_signal(best))
+				best = v[j];
+		for (k = i; k < j; k++) {
+			if (v[k] == best)
+				continue;
+			/* Another radio may have caught the probe response of a hidden BSS. */
+			if (!*best->essid && *v[k]->essid)
+				memcpy(best->essid, v[k]->essid, sizeof(best->essid));
+			best->essid_hidden |= v[k]->essid_hidden;
+			free(v[k]);
+		}
+		add_scan_entry(sr, best);
+	}
+	free(v);
+}
+
+/*
+ *	Client-side filtering
+ */
+
+/** Fold the band/hidden settings of @conf into @sf. */
+void scan_filter_sync(struct scan_filter *sf)
+{
+	if (sf->band == conf.scan_filter_band && sf->hidden == conf.scan_hidden_essids &&
+	    sf->generation)
+		return;
+
+	sf->band   = conf.scan_filter_band;
+	sf->hidden = conf.scan_hidden_essids;
+
+	sf->require &= ~(SF_BAND_2G | SF_BAND_5G);
+	if (sf->band == SCAN_FILTER_BAND_2G)
+		sf->require |= SF_BAND_2G;
+	else if (sf->band == SCAN_FILTER_BAND_5G)
+		sf->require |= SF_BAND_5G;
+
+	if (sf->hidden)
+		sf->exclude &= ~SF_HIDDEN;
+	else
+		sf->exclude |= SF_HIDDEN;
+	sf->generation++;
+}
+
+/* Parse 6 hex digits (ignoring ':', '-', '.' separators) of @s into @oui. */
+static bool parse_oui(const char *s, uint8_t oui[3])
+{
+	int nibbles = 0;
+
+	for (; *s && nibbles < 6; s++) {
+		if (strchr(":-.", *s))
+			continue;
+		if (!isxdigit(*s))
+			return false;
+		oui[nibbles / 2] = (oui[nibbles / 2] << 4) |
+				   (isdigit(*s) ? *s - '0' : tolower(*s) - 'a' + 10);
+		nibbles++;
+	}
+	return nibbles == 6 && !*s;
+}
+
+/**
+ * Set the user-defined part of @sf from @expr, which is a list of
+ * space-separated terms:
+ * - 'open' / 'enc':  only open / encrypted access points,
+ * - 'sig:<dBm>':     minimum signal level (e.g. 'sig:-70'),
+ * - 'oui:<prefix>':  vendor prefix (e.g. 'oui:00:11:22'),
+ * - anything else:   (case-insensitive) ESSID regular expression.
+ * An empty @expr clears the filter. Returns NULL if ok, else an error message.
+ */
+const char *scan_filter_set_expr(struct scan_filter *sf, const char *expr)
+{
+	static char err[128];
+	char buf[sizeof(sf->expr)], pattern[sizeof(sf->expr)] = "", *tok, *end;
+	struct scan_filter new = *sf;
+	int ret;
+
+	new.require   &= SF_BAND_2G | SF_BAND_5G;
+	new.exclude   &= SF_HIDDEN;
+	new.sig_min    = 0;
+	new.has_oui    = false;
+	new.has_essid  = false;
+
+	snprintf(buf, sizeof(buf), "%s", expr);
+	for (tok = strtok(buf, " \t"); tok; tok = strtok(NULL, " \t")) {
+		if (strcasecmp(tok, "open") == 0) {
+			new.require |= SF_OPEN;
+		} else if (strcasecmp(tok, "enc") == 0) {
+			new.exclude |= SF_OPEN;
+		} else if (strncasecmp(tok, "sig:", 4) == 0) {
+			long sig = strtol(tok + 4, &end, 10);
+
+			if (*end || !in_range(sig, -127, -1))
+				return "signal must be given as negative dBm value";
+			new.sig_min = sig;
+		} else if (strncasecmp(tok, "oui:", 4) == 0) {
+			if (!parse_oui(tok + 4, new.oui))
+				return "OUI must consist of 3 hex octets";
+			new.has_oui = true;
+		} else {
+			if (*pattern)
+				strcat(pattern, " ");
+			strcat(pattern, tok);
+		}
+	}
+
+	if (*pattern) {
+		ret = regcomp(&new.essid_re, pattern, REG_EXTENDED | REG_ICASE | REG_NOSUB);
+		if (ret) {
+			regerror(ret, &new.essid_re, err, sizeof(err));
+			return err;
+		}
+		new.has_essid = true;
+	}
+
+	if (sf->has_essid)
+		regfree(&sf->essid_re);
+	*sf = new;
+	snprintf(sf->expr, sizeof(sf->expr), "%s", expr);
+	sf->generation++;
+	return NULL;
+}
+
+/* Add @cur to the aggregates @gs of its &scan_group. */
+static void group_stats_add(struct group_stats *gs, const struct scan_entry *cur)
+{
+	if (!gs->count) {
+		gs->sig_max = gs->sig_min = cur->bss_signal;
+	} else if (cur->bss_signal) {
+		if (!gs->sig_max || cur->bss_signal > gs->sig_max)
+			gs->sig_max = cur->bss_signal;
+		if (!gs->sig_min || cur->bss_signal < gs->sig_min)
+			gs->sig_min = cur->bss_signal;
+	}
+	gs->count++;
+	gs->bands |= cur->filter_bits & (SF_BAND_2G | SF_BAND_5G);
+
+	for (int i = 0; i < gs->num_chans && i < MAX_GROUP_CHANS; i++)
+		if (gs->chans[i] == cur->chan)
+			return;
+	if (gs->num_chans < MAX_GROUP_CHANS)
+		gs->chans[gs->num_chans] = cur->chan;
+	if (gs->num_chans < UINT8_MAX)
+		gs->num_chans++;
+}
+
+/**
+ * Mark the entries of @sr that match @sf, return the number of matches.
+ * Also aggregates the matching members of each &scan_group.
+ * Needs to be called with @sr->mutex held.
+ */
+size_t scan_filter_apply(struct scan_result *sr, const struct scan_filter *sf)
+{
+	size_t count = 0;
+
+	for (struct scan_entry *cur = sr->head; cur; cur = cur->next) {
+		cur->filtered = scan_filter_match(sf, cur);
+		count += cur->filtered;
+	}
+
+	for (size_t g = 0; g < sr->num.groups; g++) {
+		struct scan_group *grp = sr->groups + g;
+
+		memset(&grp->shown, 0, sizeof(grp->shown));
+		for (struct scan_entry *cur = grp->members; cur; cur = cur->group_next)
+			if (cur->filtered)
+				group_stats_add(&grp->shown, cur);
+	}
+	return count;
+}
+
+/*
+ * 	Channel statistics shown at the bottom of scan screen.
+ */
+
+/*
+ * For lsearch, it compares key value with array member, needs to
+ * return 0 if they are the same, non-0 otherwise.
+ */
+static int cmp_key(const void *a, const void *b)
+{
+	return ((struct cnt *)a)->val - ((struct cnt *)b)->val;
+}
+
+/* For quick-sorting the array in descending order of counts */
+static int cmp_cnt(const void *a, const void *b)
+{
+	if (conf.scan_sort_order == SO_CHAN && !conf.scan_sort_asc)
+		return ((struct cnt *)a)->count - ((struct cnt *)b)->count;
+	return ((struct cnt *)b)->count - ((struct cnt *)a)->count;
+}
+
+/**
+ * Fill in sr->channel_stats (must not have been allocated yet).
+ */
+static void compute_channel_stats(struct scan_result *sr)
+{
+	struct scan_entry *cur;
+	struct cnt *bin, key = {0, 0};
+	size_t n = 0;
+
+	if (!sr->num.entries)
+		return;
+
+	sr->channel_stats = calloc(sr->num.entries, sizeof(key));
+	for (cur = sr->head; cur; cur = cur->next) {
+		if (cur->chan >= 0) {
+			key.val = cur->chan;
+			bin = lsearch(&key, sr->channel_stats, &n, sizeof(key), cmp_key);
+			if (bin)
+				bin->count++;
+		}
+	}
+
+	if (n > 0) {
+		qsort(sr->channel_stats, n, sizeof(key), cmp_cnt);
+	} else {
+		free(sr->channel_stats);
+		sr->channel_stats = NULL;
+	}
+	sr->num.ch_stats = n < MAX_CH_STATS ? n : MAX_CH_STATS;
+}
+
+/*
+ *	Co-/adjacent-channel interference, per 20 MHz channel.
+ */
+
+/* For lsearch: compare frequencies of &chan_occupancy entries. */
+static int cmp_occ_freq(const void *a, const void *b)
+{
+	return ((struct chan_occupancy *)a)->freq - ((struct chan_occupancy *)b)->freq;
+}
+
+/**
+ * Contribution of @e to the channels it occupies, 0..1: the signal level
+ * (-95 dBm counts as nothing, -45 dBm and above count fully) scaled by the
+ * BSS-load channel utilisation. Beacons alone take some airtime, and a BSS
+ * not announcing its load is assumed to be half busy.
+ */
+static float occupancy_weight(const struct scan_entry *e)
+{
+	float sig, load;
+
+	if (e->bss_signal)
+		sig = map_range(clamp(e->bss_signal, -95, -45), -95, -45, 0, 1);
+	else
+		sig = e->bss_signal_qual / 1e2;
+
+	if (e->has_bss_load)
+		load = map_val(e->bss_chan_usage / 255.0, 0.25, 1);
+	else
+		load = 0.5;
+
+	return sig * load;
+}
+
+/* Add @weight to the 20 MHz channel @freq, weighted by @overlap in MHz. */
+static void occupancy_add(struct scan_result *sr, size_t *n, size_t max_n,
+			  int freq, int overlap, float weight, uint8_t load)
+{
+	struct chan_occupancy key = { .freq = freq }, *bin;
+
+	if (*n == max_n)
+		return;
+	bin = lsearch(&key, sr->occupancy, n, sizeof(key), cmp_occ_freq);
+	if (!bin->count)
+		bin->chan = ieee80211_frequency_to_channel(freq);
+	bin->count++;
+	bin->score += weight * overlap / 20.0;
+	if (load > bin->max_load)
+		bin->max_load = load;
+}
+
+/* Add the segment @ctr/@width MHz of @e to all 20 MHz channels overlapping it. */
+static void occupancy_add_segment(struct scan_result *sr, size_t *n, size_t max_n,
+				  const struct scan_entry *e, int ctr, float weight)
+{
+	const int lo = ctr - e->chan_width / 2, hi = ctr + e->chan_width / 2;
+	const uint8_t load = e->has_bss_load ? e->bss_chan_usage : 0;
+	int f;
+
+	if (e->freq < 2500) {
+		/* 2.4 GHz channels are spaced 5 MHz apart and overlap partially. */
+		for (f = 2412; f <= 2484; f = f == 2472 ? 2484 : f + 5) {
+			int overlap = (hi < f + 10 ? hi : f + 10) - max(lo, f - 10);
+
+			if (overlap > 0)
+				occupancy_add(sr, n, max_n, f, overlap, weight, load);
+		}
+	} else {
+		/* 5/6 GHz channels are on a 20 MHz raster, wide channels are bonded. */
+		for (f = lo + 10; f < hi; f += 20)
+			occupancy_add(sr, n, max_n, f, 20, weight, load);
+	}
+}
+
+/* Interference score of the 20 MHz channel at @freq (0 if not overlapped by any BSS). */
+float chan_occupancy_score(const struct scan_result *sr, int freq)
+{
+	struct chan_occupancy key = { .freq = freq }, *occ;
+
+	occ = bsearch(&key, sr->occupancy, sr->num.occupancy, sizeof(key), cmp_occ_freq);
+	return occ ? occ->score : 0;
+}
+
+/**
+ * Fill in sr->occupancy (must not have been allocated yet), sorted by frequency.
+ * Each BSS counts against every 20 MHz channel that its (possibly bonded)
+ * channel overlaps, rather than just its primary channel.
+ */
+static void compute_chan_occupancy(struct scan_result *sr)
+{
+	/* Upper bound: all 2.4 GHz (14), 5 GHz (~40), and 6 GHz (59) channels. */
+	const size_t max_n = 128;
+	struct scan_entry *cur;
+	size_t n = 0;
+
+	if (!sr->num.entries)
+		return;
+
+	sr->occupancy = calloc(max_n, sizeof(*sr->occupancy));
+	if (!sr->occupancy)
+		err_sys("unable to allocate channel occupancy");
+
+	for (cur = sr->head; cur; cur = cur->next) {
+		const float weight = occupancy_weight(cur);
+
+		if (!cur->chan_width)
+			continue;
+		occupancy_add_segment(sr, &n, max_n, cur, cur->freq_ctr1, weight);
+		if (cur->freq_ctr2)
+			occupancy_add_segment(sr, &n, max_n, cur, cur->freq_ctr2, weight);
+	}
+
+	if (n > 0) {
+		qsort(sr->occupancy, n, sizeof(*sr->occupancy), cmp_occ_freq);
+	} else {
+		free(sr->occupancy);
+		sr->occupancy = NULL;
+	}
+	sr->num.occupancy = n;
+}
+
+/*
+ *	HE BSS-colour collisions.
+ */
+
+/* Transmitting BSS of the Multiple BSSID set of @e, i.e. of its physical access point. */
+static const struct scan_entry *mbssid_radio(const struct scan_entry *e)
+{
+	return e->mbssid_tx ? e->mbssid_tx : e;
+}
+
+/**
+ * Flag co-channel entries of @sr sharing the same (enabled) BSS colour, which
+ * defeats spatial reuse. Entries are indexed by (frequency, colour) in a hash.
+ * The BSSes of one Multiple BSSID set share their colour by design, hence only
+ * entries of different sets collide; needs expand_mbssid() to have run.
+ */
+static void compute_color_collisions(struct scan_result *sr)
+{
+	struct scan_entry *cur, **entry;
+	uint32_t *buckets, *hnext, idx;
+	size_t nbuckets, n = 0;
+
+	if (!sr->num.entries)
+		return;
+
+	nbuckets = roundup_pow2(sr->num.entries);
+	buckets  = calloc(nbuckets, sizeof(*buckets));
+	hnext    = calloc(sr->num.entries, sizeof(*hnext));
+	entry    = calloc(sr->num.entries, sizeof(*entry));
+	if (!buckets || !hnext || !entry)
+		err_sys("unable to allocate BSS-colour index");
+
+	for (cur = sr->head; cur; cur = cur->next) {
+		const uint32_t key[2] = { cur->freq, cur->bss_color };
+		uint32_t *b;
+
+		if (!cur->bss_color || cur->bss_color_disabled)
+			continue;
+
+		b = &buckets[hash_fnv1a(key, sizeof(key)) & (nbuckets - 1)];
+		for (idx = *b; idx; idx = hnext[idx - 1]) {
+			struct scan_entry *other = entry[idx - 1];
+
+			if (other->freq == cur->freq && other->bss_color == cur->bss_color &&
+			    mbssid_radio(other) != mbssid_radio(cur)) {
+				sr->num.color_collisions += !other->color_collision + !cur->color_collision;
+				other->color_collision = cur->color_collision = true;
+			}
+		}
+		entry[n] = cur;
+		hnext[n] = *b;
+		*b = ++n;
+	}
+	free(entry);
+	free(hnext);
+	free(buckets);
+}
+
+/*
+ *	Grouping of entries by ESSID.
+ */
+/**
+ * Fill in sr->groups (must not have been allocated yet). Called once per scan,
+ * after sorting, so that groups and their members follow the display order.
+ * Entries are hashed by ESSID; hidden ESSIDs form one group.
+ */
+static void compute_essid_groups(struct scan_result *sr)
+{
+	struct scan_entry *cur, **tail;
+	struct scan_group *grp;
+	uint32_t *buckets, idx;
+	size_t nbuckets, n = 0;
+
+	if (!sr->num.entries)
+		return;
+
+	nbuckets = roundup_pow2(sr->num.entries);
+	buckets  = calloc(nbuckets, sizeof(*buckets));
+	sr->groups = calloc(sr->num.entries, sizeof(*sr->groups));
+	tail = calloc(sr->num.entries, sizeof(*tail));
+	if (!buckets || !sr->groups || !tail)
+		err_sys("unable to allocate ESSID groups");
+
+	for (cur = sr->head; cur; cur = cur->next) {
+		uint32_t *b = &buckets[hash_fnv1a(cur->essid, strlen(cur->essid)) & (nbuckets - 1)];
+
+		for (idx = *b; idx; idx = sr->groups[idx - 1].hnext)
+			if (!strcmp(sr->groups[idx - 1].members->essid, cur->essid))
+				break;
+
+		if (!idx) {
+			grp = sr->groups + n;
+			grp->members = cur;
+			grp->hnext   = *b;
+			tail[n] = cur;
+			*b = ++n;
+		} else {
+			grp = sr->groups + idx - 1;
+			tail[idx - 1]->group_next = cur;
+			tail[idx - 1] = cur;
+		}
+		cur->group_next = NULL;
+		group_stats_add(&grp->all, cur);
+	}
+	free(tail);
+	free(buckets);
+	sr->groups = realloc(sr->groups, n * sizeof(*sr->groups));
+	sr->num.groups = n;
+}
+
+/*
+ *	Ranking of roaming candidates (same ESSID as the associated BSS).
+ */
+
+/* Advantage in dB attributed to a BSS on the 5/6 GHz bands. */
+#define ROAM_BAND_BONUS		3
+/* Penalty in dB for a fully utilised channel, as announced in the BSS load. */
+#define ROAM_LOAD_PENALTY	10
+/* Penalty in dB per associated station (up to ROAM_MAX_STA stations). */
+#define ROAM_STA_PENALTY	0.25
+#define ROAM_MAX_STA		40
+/* Advantage in dB of supporting radio measurement (neighbour reports). */
+#define ROAM_RM_BONUS		2
+
+/* Estimated quality in dB of associating with @e, at a signal level of @signal. */
+static float roam_score(const struct scan_entry *e, int signal)
+{
+	float score = signal;
+
+	if (e->freq >= 5000)
+		score += ROAM_BAND_BONUS;
+	if (e->has_bss_load)
+		score -= ROAM_LOAD_PENALTY * e->bss_chan_usage / 255.0 +
+			 ROAM_STA_PENALTY * clamp(e->bss_sta_count, 0, ROAM_MAX_STA);
+	if (e->rm_enabled || (e->bss_capa & WLAN_CAPABILITY_RADIO_MEASURE))
+		score += ROAM_RM_BONUS;
+	return score;
+}
+
+/* For quick-sorting roaming candidates in descending order of scores */
+static int cmp_roam(const void *a, const void *b)
+{
+	const float sa = ((struct roam_candidate *)a)->score,
+		    sb = ((struct roam_candidate *)b)->score;
+
+	return (sa < sb) - (sa > sb);
+}
+
+/**
+ * Fill in @link from the link statistics @ls, unless not associated.
+ */
+void link_sample_set(struct link_sample *link, const struct iw_nl80211_linkstat *ls)
+{
+	if (ether_addr_is_zero(&ls->bssid))
+		return;
+
+	link->bssid = ls->bssid;
+	/* As in iw_cache_update(): prefer station over BSS probe signal levels. */
+	link->signal = ls->signal ? ls->signal : ls->signal_avg ? ls->signal_avg : ls->bss_signal;
+	if (link->signal > 0)
+		link->signal *= -1;
+	snprintf(link->tx_bitrate, sizeof(link->tx_bitrate), "%s", ls->tx_bitrate);
+}
+
+/**
+ * Fill in sr->link from the link statistics of the interface.
+ */
+static void update_link_sample(struct scan_result *sr)
+{
+	static struct iw_nl80211_linkstat ls;
+	static uint32_t gen;
+
+	gen = sampling_get(&ls, gen, NULL);
+	link_sample_set(&sr->link, &ls);
+}
+
+/**
+ * Fill in sr->roam_cur and sr->roam (must not have been allocated yet). Joins
+ * the associated BSS of the link sample with @sr, and ranks the other members
+ * of its &scan_group. Must be called after compute_essid_groups().
+ */
+static void compute_roam_candidates(struct scan_result *sr)
+{
+	struct scan_entry *cur;
+	struct scan_group *grp;
+	int signal;
+	float base;
+	size_t g, n = 0;
+
+	if (ether_addr_is_zero(&sr->link.bssid))
+		return;
+
+	for (g = 0, grp = NULL; g < sr->num.groups && !grp; g++)
+		for (cur = sr->groups[g].members; cur; cur = cur->group_next)
+			if (!memcmp(&cur->ap_addr, &sr->link.bssid, sizeof(sr->link.bssid))) {
+				grp = sr->groups + g;
+				break;
+			}
+	if (!grp)
+		return;
+	sr->roam_cur = cur;
+
+	signal = sr->link.signal ? sr->link.signal : cur->bss_signal;
+	if (!sr->link.signal)
+		sr->link.signal = signal;
+
+	if (grp->all.count < 2 || !*cur->essid)
+		return;
+
+	sr->roam = calloc(grp->all.count - 1, sizeof(*sr->roam));
+	if (!sr->roam)
+		err_sys("unable to allocate roaming candidates");
+
+	base = roam_score(cur, signal);
+	for (cur = grp->members; cur; cur = cur->group_next) {
+		if (cur == sr->roam_cur || !cur->bss_signal)
+			continue;
+		sr->roam[n].entry = cur;
+		sr->roam[n].score = roam_score(cur, cur->bss_signal) - base;
+		n++;
+	}
+	qsort(sr->roam, n, sizeof(*sr->roam), cmp_roam);
+	sr->num.roam = n;
+}
+
+/*
+ *	Scan results.
+ */
+static void _clear_scan_result(struct scan_result *sr)
+{
+	free_scan_list(sr->head);
+	free(sr->channel_stats);
+	free(sr->groups);
+	free(sr->occupancy);
+	free(sr->roam);
+	free(sr->plan);
+
+	sr->head          = NULL;
+	sr->channel_stats = NULL;
+	sr->groups        = NULL;
+	sr->occupancy     = NULL;
+	sr->roam_cur      = NULL;
+	memset(&sr->link, 0, sizeof(sr->link));
+	sr->roam          = NULL;
+	sr->plan          = NULL;
+	sr->msg[0]        = '\0';
+	sr->updated       = 0;
+	sr->stale         = false;
+	memset(&(sr->num), 0, sizeof(sr->num));
+	sr->generation++;
+}
+
+/*
+ * Report a failed scan. The last good snapshot is kept (marked stale), since
+ * it is still more useful than a blank screen; if @clear, it is discarded.
+ */
+static void _write_warning_msg(struct scan_result *sr, bool clear, const char *format, ...)
+{
+	va_list argp;
 
 	va_start(argp, format);
 
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 	pthread_mutex_lock(&sr->mutex);
 
-	_clear_scan_result(sr);
+	if (clear)
+		_clear_scan_result(sr);
 	vsnprintf(sr->msg, sizeof(sr->msg), format, argp);
+	sr->stale = sr->head != NULL;
+
+	pthread_mutex_unlock(&sr->mutex);
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+}
+
+/* Channels that the default interface sweeps while other radios sweep the rest. */
+static char split_name[32];
+static struct scan_band split_band = { .name = split_name };
+
+/* Number of channels of band @b on device @d: 0 is the default interface, else radio @d - 1. */
+static size_t band_channels(const struct iw_nl80211_freqs *fl, size_t d, size_t b)
+{
+	size_t n = 0;
+
+	if (!d)
+		return scan_bands[b].len / sizeof(*scan_bands[b].attrs);
+	for (size_t i = 0; i < fl[d - 1].num; i++)
+		n += freq_band(fl[d - 1].freq[i]) == (int)b;
+	return n;
+}
+
+/*
+ * Share the bands between the default interface and the other radios, so that
+ * they sweep in parallel and a round takes as long as the slowest share. Each
+ * band, the largest first, goes to the capable device with the least channels
+ * to sweep after taking it, the default interface on a tie. Bands of the default
+ * interface that go to another radio are removed from @scan_bands, its share is
+ * in @split_band. A radio whose channels are unknown sweeps all of them.
+ */
+static void radios_split(void)
+{
+	struct iw_nl80211_freqs *fl = calloc(num_radios, sizeof(*fl));
+	size_t *load = calloc(num_radios + 1, sizeof(*load));
+	bool done[ARRAY_SIZE(scan_bands)] = { false };
+	size_t b, c, d, r, best, largest;
+
+	if (!fl || !load)
+		err_sys("unable to allocate radio channels");
+	for (r = 0; r < num_radios; r++)
+		iw_nl80211_get_ifindex_freqs(&radios[r].cmd, radios[r].ifindex, fl + r);
+
+	for (;;) {
+		for (largest = 0, b = ARRAY_SIZE(scan_bands), c = 0; c < ARRAY_SIZE(scan_bands); c++)
+			for (d = 0; d <= num_radios; d++)
+				if (!done[c] && band_channels(fl, d, c) > largest) {
+					largest = band_channels(fl, d, c);
+					b       = c;
+				}
+		if (b == ARRAY_SIZE(scan_bands))
+			break;
+		done[b] = true;
+
+		for (best = num_radios + 1, d = 0; d <= num_radios; d++)
+			if (band_channels(fl, d, b) && (best > num_radios ||
+			    load[d] + band_channels(fl, d, b) < load[best] + band_channels(fl, best, b)))
+				best = d;
+		load[best] += band_channels(fl, best, b);
+		if (!best)
+			continue;
+
+		for (size_t i = 0; i < fl[best - 1].num; i++)
+			if (freq_band(fl[best - 1].freq[i]) == (int)b)
+				band_add_freq(&radios[best - 1].share, fl[best - 1].freq[i]);
+		band_clear(scan_bands + b);
+	}
+
+	for (r = 0; r < num_radios; r++)
+		radios[r].idle = fl[r].num && !radios[r].share.len;
+	for (b = 0; b < ARRAY_SIZE(scan_bands); b++) {
+		for (size_t i = 0; i < band_channels(fl, 0, b); i++)
+			band_add_freq(&split_band, scan_bands[b].attrs[i].freq);
+		if (scan_bands[b].len)
+			snprintf(split_name + strlen(split_name), sizeof(split_name) - strlen(split_name),
+				 "%s%s", *split_name ? " + " : "", scan_bands[b].name);
+	}
+	free(load);
+	free(fl);
+}
+
+/*
+ * Divide the channels of the default interface by band, and among the other
+ * radios if any. Sets @num_scan_bands to the number of bands that the default
+ * interface sweeps one at a time, or to 0 if a round is swept by one trigger.
+ */
+static void scan_bands_init(void)
+{
+	struct iw_nl80211_freqs fl;
+	size_t i, b;
+
+	for (b = 0; b < ARRAY_SIZE(scan_bands); b++)
+		band_clear(scan_bands + b);
+	band_clear(&split_band);
+	*split_name    = '\0';
+	num_scan_bands = 0;
+
+	iw_nl80211_get_freqs(&fl);
+	for (i = 0; i < fl.num; i++)
+		band_add_freq(scan_bands + freq_band(fl.freq[i]), fl.freq[i]);
+
+	if (num_radios)
+		radios_split();
+	if (!conf.scan_progressive)
+		return;
+
+	/* A single band is swept in one go anyway. */
+	for (b = 0; b < ARRAY_SIZE(scan_bands); b++)
+		num_scan_bands += scan_bands[b].len > 0;
+	if (num_scan_bands < 2)
+		num_scan_bands = 0;
+}
+
+/*
+ *	Traffic-aware deferral of scans
+ */
+/* Longest time that scans are deferred for, in seconds. */
+#define SCAN_MAX_DEFER		30
+
+/* Interval between samples of the link traffic while deferring, in ms. */
+#define TRAFFIC_SAMPLE_MS	1000
+
+/**
+ * struct link_traffic - state of the deferral of scans
+ * @d:           deferral statistics, published with each scan result
+ * @bytes:       rx + tx bytes of the link at the last sample
+ * @retries:     tx retries of the link at the last sample
+ * @sampled:     time of the last sample (prof_now()), 0 if none
+ * @since:       time since which scans have been deferred, 0 if not deferring
+ * @round_start: time at which the current full round of scans started, 0 if none
+ * @period_us:   duration of the last full round of scans, including the pause after it
+ * @sweep_us:    off-channel time of the last full round (its firmware stages)
+ * @cur_us:      off-channel time of the round in progress
+ * @next_band:   band to sweep by the next round under traffic
+ * @no_low_prio: whether the driver does not support low-priority scans
+ */
+static struct link_traffic {
+	struct scan_deferral	d;
+	uint64_t		bytes,
+				sampled,
+				since,
+				round_start;
+	uint32_t		retries,
+				period_us,
+				sweep_us,
+				cur_us;
+	size_t			next_band;
+	bool			no_low_prio;
+} traffic;
+
+/*
+ * Sample the traffic counters of the link, setting the traffic rate, and the
+ * retry rate of the interval since the last sample (a round of scans if @scanning).
+ */
+static void traffic_sample(bool scanning)
+{
+	static struct iw_nl80211_linkstat ls;
+	static uint32_t gen;
+	float *retry = scanning ? &traffic.d.retry_scan : &traffic.d.retry_idle, rate, secs;
+	uint64_t now;
+
+	/* Sample times are prof_now() times, too. */
+	gen  = sampling_get(&ls, gen, &now);
+	secs = (now - traffic.sampled) / 1e9;
+	if (ether_addr_is_zero(&ls.bssid)) {
+		traffic.d.kbps = 0;
+		traffic.sampled = 0;
+		return;
+	}
+
+	/* Counters restart on reassociation. */
+	if (traffic.sampled && secs > 0 && ls.rx_bytes + ls.tx_bytes >= traffic.bytes &&
+	    ls.tx_retries >= traffic.retries) {
+		traffic.d.kbps = (ls.rx_bytes + ls.tx_bytes - traffic.bytes) * 8 / 1e3 / secs;
+		rate = (ls.tx_retries - traffic.retries) / secs;
+		*retry = *retry ? (7 * *retry + rate) / 8 : rate;
+	}
+	traffic.bytes   = ls.rx_bytes + ls.tx_bytes;
+	traffic.retries = ls.tx_retries;
+	traffic.sampled = now;
+}
+
+/*
+ * Decide whether to skip the next round of scans, since the link carries more
+ * traffic than the 'scan_defer_threshold' setting. After %SCAN_MAX_DEFER seconds,
+ * a round is run anyway (sweeping only one band, see traffic_band()), and the
+ * deferral starts over.
+ */
+static bool traffic_defer(void)
+{
+	const uint64_t now = prof_now(), last = traffic.sampled;
+
+	if (!conf.scan_defer) {
+		traffic.d.busy = false;
+		traffic.since  = 0;
+		return false;
+	}
+
+	if (traffic.since && now - traffic.sampled < TRAFFIC_SAMPLE_MS * 1000000ULL)
+		return true;
+	traffic_sample(false);
+	traffic.d.busy = traffic.d.kbps >= (uint32_t)conf.scan_defer;
+
+	if (!traffic.d.busy) {
+		traffic.since = 0;
+		if (traffic.round_start)
+			traffic.period_us = (now - traffic.round_start) / 1000;
+		traffic.round_start = now;
+		return false;
+	}
+	if (!traffic.since) {
+		traffic.since       = now;
+		traffic.round_start = 0;
+		return true;
+	}
+
+	traffic.d.deferred_ms += (now - last) / 1000000;
+	/* Scale the deferred time by the share of time that the last full round spent off-channel. */
+	if (traffic.period_us)
+		traffic.d.avoided_ms += (now - last) / 1000000 * traffic.sweep_us / traffic.period_us;
+	if (now - traffic.since < SCAN_MAX_DEFER * 1000000000ULL)
+		return true;
+
+	traffic.since = now;
+	traffic.d.low_prio++;
+	return false;
+}
+
+/* The band that a round under traffic sweeps, taking turns (NULL: all channels). */
+static const struct scan_band *traffic_band(void)
+{
+	size_t b;
+
+	if (!num_scan_bands)
+		return NULL;
+	do
+		b = traffic.next_band++ % ARRAY_SIZE(scan_bands);
+	while (!scan_bands[b].len);
+	return scan_bands + b;
+}
 
+/* Whether @band is the last enabled band, i.e. ends a round of traffic_band(). */
+static bool band_is_last(const struct scan_band *band)
+{
+	for (size_t b = band - scan_bands + 1; b < ARRAY_SIZE(scan_bands); b++)
+		if (scan_bands[b].len)
+			return false;
+	return true;
+}
+
+/* Publish the deferral statistics into @sr, while no scan results are published. */
+static void traffic_publish(struct scan_result *sr)
+{
+	static uint64_t published;
+
+	/* Only changed by a new sample. */
+	if (published == traffic.sampled)
+		return;
+	published = traffic.sampled;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_mutex_lock(&sr->mutex);
+	sr->defer = traffic.d;
+	if (!sr->head)
+		snprintf(sr->msg, sizeof(sr->msg), "Scans deferred: link traffic at %u kbit/s", traffic.d.kbps);
+	sr->generation++;
 	pthread_mutex_unlock(&sr->mutex);
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 }
 
-/** The actual scan thread. */
-void *do_scan(void *sr_ptr)
+/*
+ * Sweep @band (NULL: all channels), and publish the results into @sr, as the
+ * last sweep of a round if @last. Returns false if the rest of the round is to
+ * be skipped, since the scan could not be run.
+ */
+static bool scan_step(struct scan_result *sr, uint32_t ifindex, const struct scan_band *band, bool last)
+{
+	uint32_t trigger_us;
+	uint64_t lap;
+	int ret;
+
+	lap = prof_now();
+	ret = iw_nl80211_scan_trigger(band, traffic.d.busy && !traffic.no_low_prio);
+	if (ret == -EOPNOTSUPP && traffic.d.busy && !traffic.no_low_prio) {
+		traffic.no_low_prio = true;
+		ret = iw_nl80211_scan_trigger(band, false);
+	}
+	trigger_us = prof_lap(&lap);
+
+	if (-ret == EPERM && !has_net_admin_capability()) {
+		_write_warning_msg(sr, false, "This screen requires CAP_NET_ADMIN permissions");
+		pthread_exit(0);
+	} else if (-ret == ENETDOWN && default_interface_is_rfkill_blocked()) {
+		_write_warning_msg(sr, false, "Interface %s is blocked by rfkill", conf_ifname());
+		return false;
+	} else if (-ret == ENETDOWN && !if_is_up(conf_ifname())) {
+		_write_warning_msg(sr, false, "Interface %s is down - setting it up ...", conf_ifname());
+
+		if (if_set_up(conf_ifname()) < 0)
+			err_sys("Can not bring up interface '%s'", conf_ifname());
+		if (atexit(if_set_down_on_exit) < 0)
+			_write_warning_msg(sr, false, "Warning: unable to restore %s down state on exit", conf_ifname());
+		return false;
+	}
+
+	switch(-ret) {
+	case EBUSY:
+		/* Trigger returns -EBUSY if a scan request is pending or ready. */
+	case 0:
+		/* The other radios scan while waiting for the default interface. */
+		pthread_cleanup_push(radios_cancel, NULL);
+		radios_start();
+		if (!wait_for_scan_events(scan_wait_sk, ifindex)) {
+			radios_join(NULL);
+			if (band)
+				_write_warning_msg(sr, false, "Waiting for %s scan data...", band->name);
+			else
+				_write_warning_msg(sr, false, "Waiting for scan data...");
+		} else {
+			struct scan_result *tmp = calloc(1, sizeof(*tmp));
+			size_t dumped;
+
+			if (!tmp)
+				err_sys("Out of memory");
+
+			tmp->timing.v[SP_TRIGGER]  = trigger_us;
+			tmp->timing.v[SP_FIRMWARE] = prof_lap(&lap);
+			traffic.cur_us += tmp->timing.v[SP_FIRMWARE];
+			/* The dump holds all cached BSSes, i.e. those of the other bands from earlier sweeps. */
+			ret = iw_nl80211_get_scan_data(tmp);
+			tmp->timing.v[SP_DUMP]     = prof_lap(&lap);
+			dumped = tmp->num.entries;
+			radios_join(ret < 0 ? NULL : tmp);
+			tmp->timing.v[SP_MERGE]    = prof_lap(&lap);
+			if (ret < 0) {
+				_write_warning_msg(sr, false, "Scan failed on %s: %s", conf_ifname(), strerror(-ret));
+			} else if (!tmp->head) {
+				if (last)
+					_write_warning_msg(sr, true, "Empty scan results on %s", conf_ifname());
+			} else {
+				expand_mbssid(tmp);
+				resolve_hidden_essids(tmp);
+				check_evil_twins(tmp);
+				check_new_bsses(tmp);
+				// Sort only when new data arrives.
+				compute_channel_stats(tmp);
+				compute_chan_occupancy(tmp);
+				chan_hist_append(tmp);
+				compute_chan_plan(tmp);
+				compute_color_collisions(tmp);
+				tmp->timing.v[SP_ANALYSE] = prof_lap(&lap);
+				sort_scan_list(&tmp->head);
+				tmp->timing.v[SP_SORT]    = prof_lap(&lap);
+				compute_essid_groups(tmp);
+				update_link_sample(tmp);
+				compute_roam_candidates(tmp);
+				tmp->timing.v[SP_ANALYSE] += prof_lap(&lap);
+				gps_get_fix(&tmp->fix);
+				/* Log each BSS once per round. */
+				if (last)
+					scan_log_add(tmp);
+
+				pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+				pthread_mutex_lock(&sr->mutex);
+
+				_clear_scan_result(sr);
+				sr->head          = tmp->head;
+				sr->channel_stats = tmp->channel_stats;
+				sr->groups        = tmp->groups;
+				sr->occupancy     = tmp->occupancy;
+				sr->roam_cur      = tmp->roam_cur;
+				sr->link          = tmp->link;
+				sr->roam          = tmp->roam;
+				sr->plan          = tmp->plan;
+				memcpy(sr->plan_country, tmp->plan_country, sizeof(sr->plan_country));
+				sr->max_essid_len = tmp->max_essid_len;
+				sr->fix           = tmp->fix;
+				sr->defer         = traffic.d;
+				sr->updated       = time(NULL);
+				memcpy(&(sr->num), &(tmp->num), sizeof(tmp->num));
+				for (uint32_t i = tmp->events.count > MAX_SCAN_EVENTS ?
+						  tmp->events.count - MAX_SCAN_EVENTS : 0;
+				     i < tmp->events.count; i++)
+					scan_event_push(&sr->events, tmp->events.ev + i % MAX_SCAN_EVENTS);
+				sr->generation++;
+				tmp->timing.v[SP_PUBLISH] = prof_lap(&lap);
+				scan_profile_add(&sr->profile, &tmp->timing, dumped);
+
+				pthread_mutex_unlock(&sr->mutex);
+				pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+			}
+			free(tmp->mbssid);
+			free(tmp);
+		}
+		pthread_cleanup_pop(0);
+		return ret >= 0;
+	case EFAULT:
+		/* EFAULT can occur after a window resizing event - treat as temporary error. */
+	case EINTR:
+	case EAGAIN:
+		_write_warning_msg(sr, false, "Waiting for device to become ready ...");
+		break;
+	default:
+		_write_warning_msg(sr, false, "Scan trigger failed on %s: %s", conf_ifname(), strerror(-ret));
+		break;
+	}
+	return false;
+}
+
+/*
+ *	Scan service: one scan thread, shared by the screens that use scan results,
+ *	and kept alive (with its snapshot) when switching to other screens.
+ */
+static struct scan_result scan_snapshot;
+static pthread_t scan_thread;
+static pthread_mutex_t service_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t service_cond = PTHREAD_COND_INITIALIZER;
+static bool service_running,
+	    service_foreground,		/* whether a screen uses the scan results */
+	    service_resumed;		/* whether the settings are to be read again */
+
+static void service_unlock(void *arg)
+{
+	(void)arg;
+	pthread_mutex_unlock(&service_mutex);
+}
+
+/*
+ * Wait until the next round of scans: %stat_iv while a screen uses the results,
+ * else the 'background_scan_interval', or until back in the foreground if that
+ * is 0. Returns true if the settings are to be read again.
+ */
+static bool service_wait(void)
+{
+	struct timespec deadline;
+	bool resumed;
+
+	usleep(conf.stat_iv * 1000);
+
+	pthread_mutex_lock(&service_mutex);
+	if (!service_foreground) {
+		/* Do not keep alerts from the last scans unsaved for long. */
+		pthread_mutex_unlock(&service_mutex);
+		seen_filter_sync(true);
+		pthread_mutex_lock(&service_mutex);
+
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += conf.scan_bg_iv;
+
+		pthread_cleanup_push(service_unlock, NULL);
+		if (!conf.scan_bg_iv)
+			while (!service_foreground)
+				pthread_cond_wait(&service_cond, &service_mutex);
+		else
+			while (!service_foreground &&
+			       pthread_cond_timedwait(&service_cond, &service_mutex, &deadline) != ETIMEDOUT)
+				;
+		pthread_cleanup_pop(0);
+	}
+	resumed         = service_resumed;
+	service_resumed = false;
+	pthread_mutex_unlock(&service_mutex);
+	return resumed;
+}
+
+/*
+ * The actual scan thread. With more than one band, each round of scans sweeps
+ * one band at a time, publishing the results of each band as soon as it is done.
+ */
+static void *do_scan(void *sr_ptr)
 {
 	struct scan_result *sr = sr_ptr;
+	uint32_t ifindex;
 	sigset_t blockmask;
-	int ret = 0;
 
-	/* SIGWINCH is supposed to be handled in the main thread. */
+	/* SIGWINCH is supposed to be handled in the main thread (and the radio workers). */
 	sigemptyset(&blockmask);
 	sigaddset(&blockmask, SIGWINCH);
 	pthread_sigmask(SIG_BLOCK, &blockmask, NULL);
 
-	do {
-		ret = iw_nl80211_scan_trigger();
+	if (!scan_wait_sk)
+		scan_wait_sk = alloc_nl_mcast_sk("scan");
 
-		if (-ret == EPERM && !has_net_admin_capability()) {
-			_write_warning_msg(sr, "This screen requires CAP_NET_ADMIN permissions");
-			pthread_exit(0);
-		} else if (-ret == ENETDOWN && default_interface_is_rfkill_blocked()) {
-			_write_warning_msg(sr, "Interface %s is blocked by rfkill", conf_ifname());
-			continue;
-		} else if (-ret == ENETDOWN && !if_is_up(conf_ifname())) {
-			_write_warning_msg(sr, "Interface %s is down - setting it up ...", conf_ifname());
+	for (bool resumed = true;; resumed = service_wait()) {
+		bool round_done = true;
 
-			if (if_set_up(conf_ifname()) < 0)
-				err_sys("Can not bring up interface '%s'", conf_ifname());
-			if (atexit(if_set_down_on_exit) < 0)
-				_write_warning_msg(sr, "Warning: unable to restore %s down state on exit", conf_ifname());
-			continue;
+		/* The interface or the scan settings may have changed while another screen was shown. */
+		if (resumed) {
+			ifindex = if_nametoindex(conf_ifname());
+			radios_init();
+			scan_bands_init();
 		}
 
-		switch(-ret) {
-		case EBUSY:
-			/* Trigger returns -EBUSY if a scan request is pending or ready. */
-		case 0:
-			if (!wait_for_scan_events()) {
-				_write_warning_msg(sr, "Waiting for scan data...");
-			} else {
-				struct scan_result *tmp = calloc(1, sizeof(*tmp));
-
-				if (!tmp)
-					err_sys("Out of memory");
-
-				ret = iw_nl80211_get_scan_data(tmp);
-				if (ret < 0) {
-					_write_warning_msg(sr, "Scan failed on %s: %s", conf_ifname(), strerror(-ret));
-				} else if (!tmp->head) {
-					if (conf.scan_filter_band != SCAN_FILTER_BAND_BOTH) {
-						// Reset filter in case the card does not suport the band.
-						conf.scan_filter_band = SCAN_FILTER_BAND_BOTH;
-					} else {
-						_write_warning_msg(sr, "Empty scan results on %s", conf_ifname());
-					}
-				} else {
-					// Sort only when new data arrives.
-					compute_channel_stats(tmp);
-					sort_scan_list(&tmp->head);
-
-					pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-					pthread_mutex_lock(&sr->mutex);
-
-					_clear_scan_result(sr);
-					sr->head          = tmp->head;
-					sr->channel_stats = tmp->channel_stats;
-					sr->max_essid_len = tmp->max_essid_len;
-					memcpy(&(sr->num), &(tmp->num), sizeof(tmp->num));
-
-					pthread_mutex_unlock(&sr->mutex);
-					pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-				}
-				free(tmp);
-			}
-			break;
-		case EFAULT:
-			/* EFAULT can occur after a window resizing event - treat as temporary error. */
-		case EINTR:
-		case EAGAIN:
-			_write_warning_msg(sr, "Waiting for device to become ready ...");
-			break;
-		default:
-			_write_warning_msg(sr, "Scan trigger failed on %s: %s", conf_ifname(), strerror(-ret));
-			break;
+		if (traffic_defer()) {
+			traffic_publish(sr);
+			continue;
 		}
-	} while (usleep(conf.stat_iv * 1000) == 0);
 
+		traffic.cur_us = 0;
+		if (traffic.d.busy && num_scan_bands) {
+			/* Keep the time off-channel short: one band per pass, a round takes several. */
+			const struct scan_band *band = traffic_band();
+
+			round_done = band_is_last(band);
+			scan_step(sr, ifindex, band, round_done);
+		} else if (split_band.len) {
+			/* The other radios sweep the other bands meanwhile. */
+			scan_step(sr, ifindex, &split_band, true);
+		} else if (!num_scan_bands) {
+			scan_step(sr, ifindex, NULL, true);
+		} else {
+			for (size_t b = 0, n = 0; b < ARRAY_SIZE(scan_bands); b++)
+				if (scan_bands[b].len && !scan_step(sr, ifindex, scan_bands + b, ++n == num_scan_bands))
+					break;
+		}
+		if (round_done)
+			round_end();
+		if (conf.scan_defer) {
+			traffic_sample(true);
+			if (!traffic.d.busy)
+				traffic.sweep_us = traffic.cur_us;
+		}
+	}
 	return NULL;
 }
+
+/* Stop scanning on exit, and save what has been learned. */
+static void scan_service_fini(void)
+{
+	/* Unless exiting because of an error in the scan thread itself. */
+	if (!pthread_equal(pthread_self(), scan_thread)) {
+		pthread_cancel(scan_thread);
+		pthread_join(scan_thread, NULL);
+		seen_filter_sync(true);
+	}
+}
+
+/**
+ * Bring the scan service to the foreground, starting it on first use. Returns
+ * the scan results, which are kept (and updated) while other screens are shown.
+ */
+struct scan_result *scan_service_start(void)
+{
+	pthread_mutex_lock(&service_mutex);
+	if (!service_running) {
+		pthread_mutexattr_t attr;
+
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
+		pthread_mutex_init(&scan_snapshot.mutex, &attr);
+
+		if (pthread_create(&scan_thread, NULL, do_scan, &scan_snapshot))
+			err_sys("can not start scan thread");
+		atexit(scan_service_fini);
+		service_running = true;
+	} else {
+		service_resumed = true;
+	}
+	service_foreground = true;
+	pthread_cond_signal(&service_cond);
+	pthread_mutex_unlock(&service_mutex);
+	return &scan_snapshot;
+}
+
+/**
+ * Put the scan service into the background, when leaving a screen that uses
+ * the scan results: scans continue at the 'background_scan_interval', if set.
+ */
+void scan_service_pause(void)
+{
+	pthread_mutex_lock(&service_mutex);
+	service_foreground = false;
+	pthread_mutex_unlock(&service_mutex);
+}
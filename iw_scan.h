@@ -3,10 +3,26 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 #include "iw_if.h"
+#include <regex.h>
 
 /*
  *	Organization of scan results
  */
+/** Security protocols advertised by a BSS (neither: open, or WEP if privacy is set). */
+enum scan_sec_proto {
+	SEC_PROTO_WPA	= 1 << 0,	/* WPA vendor element */
+	SEC_PROTO_RSN	= 1 << 1	/* RSN element (WPA2/WPA3) */
+};
+/* Suite-selector types >= 15 and non-standard suites, in @sec_pairwise/@sec_akm. */
+#define SEC_SUITE_OTHER		(1 << 15)
+
+/** Reasons for suspecting a BSS to be an evil twin of its ESSID. */
+enum twin_anomaly {
+	TWIN_SECURITY	= 1 << 0,	/* security protocol, ciphers, AKMs, or BSS type */
+	TWIN_OUI	= 1 << 1,	/* vendor (OUI) of the BSSID */
+	TWIN_BAND	= 1 << 2	/* frequency band */
+};
+
 /**
  * struct scan_entry  -  Representation of a single scan result.
  * @ap_addr:	     MAC address
@@ -24,6 +40,28 @@
  * @bss_capa:	     BSS capability flags
  * @bss_sta_count:   BSS station count
  * @bss_chan_usage:  BSS channel utilisation
+ * @has_bss_load:    whether @bss_sta_count and @bss_chan_usage are valid
+ * @bss_color:	     HE BSS colour 1..63 (0 if not an HE BSS)
+ * @bss_color_disabled: whether the BSS has disabled the use of @bss_color
+ * @color_collision: whether a co-channel BSS uses the same @bss_color
+ * @essid_hidden:    whether the BSS hides its ESSID in beacons (@essid may still be known)
+ * @essid_cached:    whether @essid was learned in an earlier scan
+ * @new_bss:	     whether the BSSID has never been seen at this site before
+ * @chan_width:	     occupied channel width in MHz (per segment if 80+80)
+ * @freq_ctr1:	     centre frequency of the (first) occupied segment in MHz
+ * @freq_ctr2:	     centre frequency of the second 80+80 segment (or 0)
+ * @sec_proto:	     &enum scan_sec_proto bits
+ * @sec_pairwise:    pairwise cipher suites (bit n: suite type n), of RSN and WPA
+ * @sec_akm:	     authentication and key-management suites (bit n: suite type n)
+ * @twin_flags:	     &enum twin_anomaly bits, if the BSS does not fit its ESSID
+ * @mbssid_max:	     MaxBSSID Indicator n of a transmitting BSS (up to 2^n BSSIDs), else 0
+ * @mbssid_index:    BSSID index of a nontransmitted BSS (Multiple BSSID-Index element), else 0
+ * @mbssid_count:    number of nontransmitted BSSes linked to this transmitting BSS
+ * @mbssid_synth:    whether expanded from a profile in the beacon of the transmitting BSS
+ * @mbssid_tx:	     transmitting BSS of a nontransmitted BSS (NULL if not seen)
+ * @filter_bits:     precomputed &enum scan_filter_bits of this entry
+ * @filtered:	     whether this entry matches the current &scan_filter
+ * @group_next:	     next member of the same &scan_group (in display order)
  */
 struct scan_entry {
 	struct ether_addr	ap_addr;
@@ -33,7 +71,15 @@ struct scan_entry {
 	bool			has_key:1,
 				ht_capable:1,
 				rm_enabled:1,
-				mesh_enabled:1;
+				mesh_enabled:1,
+				has_bss_load:1,
+				bss_color_disabled:1,
+				color_collision:1,
+				essid_hidden:1,
+				essid_cached:1,
+				new_bss:1,
+				filtered:1;
+	uint8_t			filter_bits;
 
 	uint32_t		last_seen;
 	uint64_t		tsf;
@@ -44,10 +90,144 @@ struct scan_entry {
 	uint8_t			bss_sta_count,
 				bss_chan_usage;
 
-	struct scan_entry	*next;
+	uint16_t		chan_width,
+				freq_ctr1,
+				freq_ctr2;
+	uint8_t			bss_color;
+
+	uint8_t			sec_proto;
+	uint16_t		sec_pairwise,
+				sec_akm;
+	uint8_t			twin_flags;
+
+	uint8_t			mbssid_max,
+				mbssid_index,
+				mbssid_count;
+	bool			mbssid_synth;
+	struct scan_entry	*mbssid_tx;
+
+	struct scan_entry	*next,
+				*group_next;
 };
 extern void sort_scan_list(struct scan_entry **headp);
 
+/**
+ * struct mbssid_profile - nontransmitted BSS announced in a Multiple BSSID element
+ * @addr:    BSSID, derived from that of the transmitting BSS and @index
+ * @tx_addr: BSSID of the transmitting BSS
+ * @freq:    frequency of the transmitting BSS in MHz
+ * @index:   BSSID index
+ * @capa:    BSS capability flags (from the Nontransmitted BSSID Capability element)
+ * @essid:   ESSID (empty if hidden)
+ */
+struct mbssid_profile {
+	struct ether_addr	addr,
+				tx_addr;
+	uint32_t		freq;
+	uint8_t			index;
+	uint16_t		capa;
+	char			essid[MAX_ESSID_LEN + 2];
+};
+
+/* Maximum number of distinct channels listed per &scan_group. */
+#define MAX_GROUP_CHANS		8
+
+/**
+ * struct group_stats - aggregates over a set of BSSIDs sharing one ESSID
+ * @count:	number of BSSIDs
+ * @sig_max:	strongest signal in dBm (0 if unknown)
+ * @sig_min:	weakest signal in dBm (0 if unknown)
+ * @bands:	union of the %SF_BAND_xx bits
+ * @chans:	distinct channels used (first %MAX_GROUP_CHANS)
+ * @num_chans:	number of distinct channels, may exceed %MAX_GROUP_CHANS
+ */
+struct group_stats {
+	uint16_t		count;
+	int8_t			sig_max,
+				sig_min;
+	uint8_t			bands;
+	uint8_t			chans[MAX_GROUP_CHANS],
+				num_chans;
+};
+
+/**
+ * struct scan_group - aggregate view of all BSSIDs sharing one ESSID
+ * @members:	first member in display order (chained via @group_next)
+ * @all:	aggregates over all members
+ * @shown:	aggregates over the members passing the filter (set by scan_filter_apply())
+ * @expanded:	whether to list the members of the group (set by the UI)
+ * @hnext:	index + 1 of the next group in the same hash bucket (0 ends)
+ */
+struct scan_group {
+	struct scan_entry	*members;
+	struct group_stats	all,
+				shown;
+	bool			expanded;
+	uint32_t		hnext;
+};
+
+/*
+ *	Client-side filtering of scan results
+ */
+/**
+ * enum scan_filter_bits - per-entry properties, computed once while parsing
+ * @SF_BAND_2G: entry is on the 2.4 GHz band
+ * @SF_BAND_5G: entry is on the 5 GHz (or higher) band
+ * @SF_OPEN:    entry does not use encryption
+ * @SF_HIDDEN:  entry has a hidden (empty) ESSID
+ */
+enum scan_filter_bits {
+	SF_BAND_2G	= 1 << 0,
+	SF_BAND_5G	= 1 << 1,
+	SF_OPEN		= 1 << 2,
+	SF_HIDDEN	= 1 << 3,
+};
+
+/**
+ * struct scan_filter - filter applied to the cached scan snapshot
+ * @require:	 &enum scan_filter_bits that must all be set
+ * @exclude:	 &enum scan_filter_bits that must all be clear
+ * @sig_min:	 minimum signal level in dBm (0 if unused)
+ * @oui:	 vendor prefix to match (if @has_oui)
+ * @has_oui:	 whether to filter on @oui
+ * @has_essid:	 whether @essid_re holds a compiled ESSID pattern
+ * @essid_re:	 ESSID regular expression (substring match)
+ * @generation:	 incremented whenever the filter changes
+ * @band:	 value of conf.scan_filter_band reflected in @require
+ * @hidden:	 value of conf.scan_hidden_essids reflected in @exclude
+ * @expr:	 expression entered by the user ('/' prompt)
+ */
+struct scan_filter {
+	uint8_t		require,
+			exclude;
+	int8_t		sig_min;
+	uint8_t		oui[3];
+	bool		has_oui,
+			has_essid;
+	regex_t		essid_re;
+
+	uint32_t	generation;
+	int		band,
+			hidden;
+	char		expr[64];
+};
+extern void scan_filter_sync(struct scan_filter *sf);
+extern const char *scan_filter_set_expr(struct scan_filter *sf, const char *expr);
+
+/** Return true if @e is to be displayed under @sf - cheapest tests first. */
+static inline bool scan_filter_match(const struct scan_filter *sf,
+				     const struct scan_entry *e)
+{
+	if ((e->filter_bits & sf->require) != sf->require ||
+	    (e->filter_bits & sf->exclude))
+		return false;
+	if (sf->sig_min && (!e->bss_signal || e->bss_signal < sf->sig_min))
+		return false;
+	if (sf->has_oui && memcmp(&e->ap_addr, sf->oui, sizeof(sf->oui)))
+		return false;
+	return !sf->has_essid || regexec(&sf->essid_re, e->essid, 0, NULL, 0) == 0;
+}
+
 /**
  * struct cnt - count frequency of integer numbers
  * @val:	value to count
@@ -58,39 +238,427 @@ struct cnt {
 	int	count;
 };
 
+/**
+ * struct chan_occupancy - interference estimate for one 20 MHz channel
+ * @freq:	centre frequency in MHz
+ * @chan:	channel number corresponding to @freq
+ * @count:	number of BSSes overlapping the channel (fully or partially)
+ * @max_load:	highest channel utilisation (0..255) reported by these BSSes
+ * @score:	sum of the overlap of these BSSes, each weighted by its signal
+ *		level and channel utilisation (1.0 ~ one strong, busy BSS)
+ */
+struct chan_occupancy {
+	uint16_t	freq,
+			chan;
+	uint16_t	count;
+	uint8_t		max_load;
+	float		score;
+};
+
+/**
+ * struct link_sample - state of the link of the scanning interface
+ * @bssid:	BSSID of the associated BSS (all zeroes if not associated)
+ * @signal:	signal level of the link in dBm (0 if unknown)
+ * @tx_bitrate:	description of the transmit bitrate
+ */
+struct link_sample {
+	struct ether_addr	bssid;
+	int8_t			signal;
+	char			tx_bitrate[100];
+};
+
+/**
+ * struct roam_candidate - other BSSID of the ESSID of the associated BSS
+ * @entry:	scan entry of the candidate
+ * @score:	estimated advantage over the associated BSS in dB (> 0 is better)
+ */
+struct roam_candidate {
+	struct scan_entry	*entry;
+	float			score;
+};
+
+/**
+ * enum chan_plan_flags - regulatory properties of a &chan_candidate
+ * @CP_DFS:	at least one subchannel requires radar detection (DFS)
+ * @CP_NO_IR:	at least one subchannel does not permit initiating radiation
+ */
+enum chan_plan_flags {
+	CP_DFS		= 1 << 0,
+	CP_NO_IR	= 1 << 1,
+};
+
+/**
+ * struct chan_candidate - candidate channel of the channel-plan recommender
+ * @freq_ctr:	centre frequency in MHz
+ * @width:	channel width in MHz
+ * @flags:	&enum chan_plan_flags
+ * @busy:	highest survey busy-time fraction among the subchannels (0..1)
+ * @cost:	estimated cost of using this channel, lower is better
+ */
+struct chan_candidate {
+	uint16_t	freq_ctr,
+			width;
+	uint8_t		flags;
+	float		busy,
+			cost;
+};
+
+/*
+ *	Evil-twin detection (evil_twin.c)
+ */
+/**
+ * struct scan_event - a BSS that was found to not fit its ESSID, or is new
+ * @time:	when the BSS was flagged
+ * @addr:	BSSID
+ * @essid:	ESSID
+ * @twin_flags:	&enum twin_anomaly bits (0 if @addr has never been seen before)
+ */
+struct scan_event {
+	time_t			time;
+	struct ether_addr	addr;
+	char			essid[MAX_ESSID_LEN + 2];
+	uint8_t			twin_flags;
+};
+
+/* Number of events kept. */
+#define MAX_SCAN_EVENTS		16
+
+/**
+ * struct scan_event_ring - the latest %MAX_SCAN_EVENTS events
+ * @ev:    circular buffer, the latest event at (@count - 1) % %MAX_SCAN_EVENTS
+ * @count: number of events so far
+ */
+struct scan_event_ring {
+	struct scan_event	ev[MAX_SCAN_EVENTS];
+	uint32_t		count;
+};
+
+/* Maximum number of distinct (OUI, security setting) pairs learned per ESSID. */
+#define TWIN_MAX_KINDS		8
+
+/**
+ * struct essid_profile - what the BSSes of one ESSID look like (fixed size,
+ * kept with the ESSID in the pool of the BSS table)
+ * @first_scan: number of the scan in which the ESSID was first seen, 0 if new
+ * @bands:      bitmask of bands (0: 2.4 GHz, 1: 5 GHz, 2: 6 GHz)
+ * @num_kinds:  number of valid entries in @ouis and @secs
+ * @ouis:       vendor prefixes of the BSSIDs (locally-administered bit cleared)
+ * @secs:       security setting used with the OUI of the same index, as
+ *              computed by security_sig()
+ */
+struct essid_profile {
+	uint32_t		first_scan;
+	uint8_t			bands,
+				num_kinds;
+	uint8_t			ouis[TWIN_MAX_KINDS][3];
+	uint64_t		secs[TWIN_MAX_KINDS];
+};
+extern uint8_t twin_check(struct scan_entry *e, uint32_t scan);
+extern const char *twin_describe(uint8_t flags);
+extern void scan_event_push(struct scan_event_ring *r, const struct scan_event *ev);
+
+/*
+ *	GPS position from gpsd (gps.c)
+ */
+/**
+ * struct gps_fix - a position reported by gpsd
+ * @mode:	0 if there is no (recent) fix, 2 for a 2D fix, 3 for a 3D fix
+ * @time:	time of the fix, as reported by the receiver
+ * @lat:	latitude in degrees (WGS 84)
+ * @lon:	longitude in degrees (WGS 84)
+ * @alt:	altitude in metres above mean sea level (3D fix only)
+ */
+struct gps_fix {
+	int		mode;
+	time_t		time;
+	double		lat,
+			lon,
+			alt;
+};
+extern void gps_init(const char *addr);
+extern bool gps_enabled(void);
+extern void gps_get_fix(struct gps_fix *fix);
+
+/*
+ *	New-BSSID detection (seen_filter.c)
+ */
+extern bool seen_filter_check(struct scan_entry *e);
+extern bool seen_filter_sync(bool force);
+
+
+/*
+ *	Scan-engine profiling (scan_profile.c)
+ */
+/** Items of a &scan_timing: stages of one scan (in us), their sum, and throughput. */
+enum scan_prof_item {
+	SP_TRIGGER,	/* trigger sent .. acknowledged */
+	SP_FIRMWARE,	/* acknowledged .. NEW_SCAN_RESULTS received */
+	SP_DUMP,	/* netlink dump of the results, excluding parsing */
+	SP_PARSE,	/* parsing of the dumped entries */
+	SP_MERGE,	/* waiting for and merging the results of other radios */
+	SP_ANALYSE,	/* statistics, occupancy, channel plan, groups, roaming */
+	SP_SORT,	/* sorting the scan list */
+	SP_PUBLISH,	/* locking and swapping in the new snapshot */
+	SP_TOTAL,	/* sum of the above */
+	SP_RATE,	/* entries per second of dump and parsing */
+	SP_NUM
+};
+extern const char *const scan_prof_names[SP_NUM];
+
+/**
+ * struct scan_timing - where the time of one scan went
+ * @v:        &enum scan_prof_item values
+ * @parse_ns: accumulated parsing time, while the dump is in progress
+ */
+struct scan_timing {
+	uint32_t	v[SP_NUM];
+	uint64_t	parse_ns;
+};
+
+/* Number of scans that the rolling percentiles are computed over. */
+#define PROF_WINDOW		64
+
+/**
+ * struct scan_profile - timings of the last %PROF_WINDOW scans
+ * @win:   circular buffer of timings, the last one at (@count - 1) % %PROF_WINDOW
+ * @count: number of scans recorded so far
+ */
+struct scan_profile {
+	struct scan_timing	win[PROF_WINDOW];
+	uint32_t		count;
+};
+extern uint64_t prof_now(void);
+extern uint32_t prof_lap(uint64_t *t);
+extern void scan_profile_add(struct scan_profile *p, struct scan_timing *t, size_t entries);
+extern const struct scan_timing *scan_profile_last(const struct scan_profile *p);
+extern uint32_t scan_profile_pct(const struct scan_profile *p, enum scan_prof_item item, int pct);
+
+/**
+ * struct scan_deferral - scans held back while the link carries traffic
+ * @busy:        whether the traffic is above the 'scan_defer_threshold' setting
+ * @kbps:        rx + tx traffic of the link at the last check, in kbit/s
+ * @low_prio:    number of sweeps run under traffic (at low priority, if supported)
+ * @deferred_ms: time during which scans were held back
+ * @avoided_ms:  off-channel time avoided, estimated from the duration of the last full round
+ * @retry_scan:  moving average of tx retries per second across scan rounds
+ * @retry_idle:  moving average of tx retries per second between scan rounds
+ */
+struct scan_deferral {
+	bool		busy;
+	uint32_t	kbps,
+			low_prio;
+	uint64_t	deferred_ms,
+			avoided_ms;
+	float		retry_scan,
+			retry_idle;
+};
+
 /**
  * struct scan_result - Structure to aggregate all collected scan data.
  * @head:	   begin of scan_entry list (may be NULL)
+ * @generation:    incremented each time a new snapshot is published
  * @msg:	   error message, if any
+ * @updated:	   time at which the current snapshot was taken (0 if none)
+ * @stale:	   whether the snapshot is kept although the latest scan failed (see @msg)
  * @max_essid_len: maximum ESSID-string length (up to %MAX_ESSID_LEN)
  * @channel_stats: array of channel statistics entries
+ * @groups:	   array of per-ESSID aggregates, in display order
+ * @occupancy:	   array of per-20 MHz interference estimates, by frequency
+ * @link:	   state of the link when the scan results were collected
+ * @roam_cur:	   entry of the associated BSS (NULL if not associated/not seen)
+ * @roam:	   array of roaming candidates, best first (if @roam_cur)
+ * @plan:	   array of channel-plan candidates, best first
+ * @plan_country:  regulatory domain that @plan is based on
+ * @timing:	   timing of the scan in progress, while building a snapshot
+ * @profile:	   timings of the last scans (only kept in the published result)
+ * @events:	   events of this scan, or (published result) the latest events
+ * @mbssid:	   Multiple BSSID profiles seen while dumping (consumed by the scan thread)
+ * @fix:	   GPS position when the scan completed (@fix.mode is 0 if unknown)
+ * @defer:	   deferral of scans because of link traffic (only kept in the published result)
  * @num.total:     number of entries in list starting at @head
  * @num.open:      number of open entries among @num.total
  * @num.hidden:    number of entries with hidden ESSIDs among @num.total
  * @num.two_gig:   number of 2.4GHz stations among @num.total
  * @num.five_gig:  number of 5 GHz stations among @num.total
  * @num.ch_stats:  length of @channel_stats array
+ * @num.groups:    length of @groups array
+ * @num.occupancy: length of @occupancy array
+ * @num.roam:      length of @roam array
+ * @num.color_collisions: number of entries with a BSS-colour collision
+ * @num.plan:      length of @plan array
+ * @num.radios:    number of interfaces that contributed results (0: only the default one)
+ * @num.unveiled:  number of entries with a hidden, but known ESSID
+ * @num.twins:     number of entries suspected to be evil twins
+ * @num.new_bss:   number of entries whose BSSID has never been seen at this site
+ * @num.mbssid:    length of @mbssid
+ * @num.physical:  number of entries that are not nontransmitted BSSes of another entry,
+ *		   i.e. the number of physical access points (radios)
  * @mutex:         protects against concurrent consumer/producer access
  */
 struct scan_result {
 	struct scan_entry *head;
+	uint32_t	  generation;
 	char		  msg[128];
+	time_t		  updated;
+	bool		  stale;
 	uint16_t	  max_essid_len;
 	struct cnt	  *channel_stats;
+	struct scan_group *groups;
+	struct chan_occupancy *occupancy;
+	struct link_sample link;
+	struct scan_entry *roam_cur;
+	struct roam_candidate *roam;
+	struct chan_candidate *plan;
+	char		  plan_country[3];
+	struct scan_timing timing;
+	struct scan_profile profile;
+	struct scan_event_ring events;
+	struct mbssid_profile *mbssid;
+	struct gps_fix	  fix;
+	struct scan_deferral defer;
 	struct assorted_numbers {
-		uint16_t	entries,
+		uint32_t	entries,
 				open,
 				hidden,
 				two_gig,
 				five_gig;
 /* Maximum number of 'top' statistics entries. */
 #define MAX_CH_STATS		3
-		size_t		ch_stats;
+		size_t		ch_stats,
+				groups,
+				occupancy,
+				roam,
+				color_collisions,
+				plan,
+				radios,
+				unveiled,
+				twins,
+				new_bss,
+				mbssid,
+				physical;
 	}		  num;
 	pthread_mutex_t   mutex;
 };
 
-extern void *do_scan(void *sr_ptr);
+extern struct scan_result *scan_service_start(void);
+extern void scan_service_pause(void);
+
+/* Receives each scan entry of scan_stream(), valid only for the duration of the call. */
+typedef void (*scan_sink_t)(const struct scan_entry *e, void *arg);
+extern int scan_stream(scan_sink_t sink, void *arg, struct scan_timing *t);
+extern int scan_stream_cached(scan_sink_t sink, void *arg, struct scan_timing *t);
+
+extern size_t scan_filter_apply(struct scan_result *sr, const struct scan_filter *sf);
+extern void link_sample_set(struct link_sample *link, const struct iw_nl80211_linkstat *ls);
+extern float chan_occupancy_score(const struct scan_result *sr, int freq);
+
+/* scan_export.c */
+enum scan_export_format {
+	SCAN_EXPORT_NONE,
+	SCAN_EXPORT_JSON,
+	SCAN_EXPORT_CSV
+};
+extern void scan_export(enum scan_export_format format, int count);
+
+/*
+ *	Persistent BSS table (bss_table.c)
+ */
+/**
+ * struct bss_record - what is remembered about a BSS across scans (fixed size)
+ * @addr:	  BSSID
+ * @twin_checked: whether the evil-twin check has been run on this BSS
+ * @new_bss:	  whether the BSSID was new to this site when first seen in this run
+ * @twin_flags:	  result of the check (&enum twin_anomaly bits)
+ * @essid:	  last ESSID seen in a beacon or probe response, as index + 1 into
+ *		  the ESSID pool (0 if unknown)
+ * @twin_key:	  hash of the ESSID, security and band that the check was run on
+ * @lru_prev:	  index + 1 of the next more recently used record (0 if none)
+ * @lru_next:	  index + 1 of the next less recently used record (0 if none)
+ * @hnext:	  index + 1 of the next record in the same hash bucket (0 if none)
+ */
+struct bss_record {
+	struct ether_addr	addr;
+	bool			twin_checked:1,
+				new_bss:1;
+	uint8_t			twin_flags;
+	uint32_t		essid,
+				twin_key,
+				lru_prev,
+				lru_next,
+				hnext;
+};
+extern struct bss_record *bss_table_find(const struct ether_addr *addr);
+extern struct bss_record *bss_table_get(const struct ether_addr *addr);
+extern bool bss_resolve_essid(struct scan_entry *e);
+extern struct essid_profile *bss_essid_profile(struct bss_record *rec, const char *essid);
+
+/*
+ *	Channel-occupancy history (chan_hist.c)
+ */
+/* Number of one-minute slots kept (one day), and their duration in seconds. */
+#define CHAN_HIST_SLOTS		1440
+#define CHAN_HIST_SLOT_SEC	60
+
+/** Per-channel metrics recorded in the history. */
+enum chan_hist_metric {
+	CH_APS,		/* number of BSSes overlapping the channel */
+	CH_UTIL,	/* occupancy score (see &struct chan_occupancy) */
+	CH_LOAD,	/* highest channel utilisation of a BSS load element, in % */
+	CH_NUM_METRICS
+};
+extern const char *const chan_hist_names[CH_NUM_METRICS];
+extern void chan_hist_append(const struct scan_result *sr);
+extern uint32_t chan_hist_generation(void);
+extern size_t chan_hist_channels(uint16_t freqs[], size_t max);
+extern float chan_hist_series(uint16_t freq, enum chan_hist_metric m, int step, float out[], int n);
+
+/* chan_plan.c */
+extern void compute_chan_plan(struct scan_result *sr);
+
+/*
+ *	Site survey (site_survey.c)
+ */
+/**
+ * struct survey_bss - scan entry, as recorded with a &survey_marker
+ * @addr:	BSSID
+ * @essid:	ESSID (may be empty)
+ * @freq:	frequency in MHz
+ * @signal:	signal level in dBm (0 if unknown)
+ */
+struct survey_bss {
+	struct ether_addr	addr;
+	char			essid[MAX_ESSID_LEN + 2];
+	uint32_t		freq;
+	int8_t			signal;
+};
+
+/**
+ * struct survey_marker - named location, with the readings taken there
+ * @next:	next marker in the write queue
+ * @time:	time the marker was dropped
+ * @name:	user-supplied name of the location
+ * @link:	link sample of the scan snapshot
+ * @num_bss:	length of @bss
+ * @bss:	copy of the scan snapshot
+ */
+struct survey_marker {
+	struct survey_marker	*next;
+	time_t			time;
+	char			name[64];
+	struct link_sample	link;
+	size_t			num_bss;
+	struct survey_bss	bss[];
+};
+extern void site_survey_init(const char *path);
+extern bool site_survey_enabled(void);
+extern size_t site_survey_mark(const char *name, const struct scan_result *sr);
+
+/*
+ *	Geotagged scan log (scan_log.c)
+ */
+extern void scan_log_init(const char *path);
+extern void scan_log_add(const struct scan_result *sr);
+extern size_t scan_log_dropped(void);
 
 /*
  * Information ID elements.
@@ -229,9 +797,25 @@ typedef enum {
 
 	IE_MCCAOP_ADV_OVERVW = 174, // 8.4.2.110: MCCAOP advertisement overview (mesh STA, MCCA information)
 
-	/* 175-220 reserved */
+	/* 175-190 reserved */
+
+	IE_VHT_CAPABILITIES  = 191, // 802.11-2016 9.4.2.158: VHT capabilities (declares STA to be VHT)
+	IE_VHT_OPERATION     = 192, // 802.11-2016 9.4.2.159: VHT operation (channel width, centre segments)
+
+	/* 193-220 reserved */
 
 	IE_VENDOR_SPECIFIC   = 221, // 8.4.2.28: Vendor specific information (non-standard)
 
-	/* 222-255 reserved */
+	/* 222-254 reserved */
+
+	IE_EXTENSION         = 255, // 802.11-2016 9.4.2.1: Element ID extension (first octet of body)
 } ie_id_t;
+
+/*
+ * Element ID extensions, found in the first octet of %IE_EXTENSION bodies.
+ * References denote 802.11ax-2021 sections.
+ */
+typedef enum {
+	IE_EXT_HE_CAPABILITIES = 35, // 9.4.2.248: HE capabilities (declares STA to be HE)
+	IE_EXT_HE_OPERATION    = 36, // 9.4.2.249: HE operation (BSS colour, 6 GHz operation)
+} ie_ext_id_t;
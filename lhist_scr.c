@@ -269,8 +269,6 @@ void scr_lhist_init(void)
 		e_signal.initialised = false;
 		last_if_idx = conf.if_idx;
 	}
-	sampling_init(true);
-
 	display_key(w_key);
 }
 
@@ -288,7 +286,6 @@ int scr_lhist_loop(WINDOW *w_menu)
 
 void scr_lhist_fini(void)
 {
-	sampling_stop();
 	delwin(w_lhist);
 	delwin(w_key);
 }
@@ -0,0 +1,194 @@
+/*
+ * Sampling service: periodic link statistics, shared by all screens.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * One thread, started once at startup, samples the link statistics of the
+ * interface every 'stat_updates' interval. Each sample is added to the level
+ * history (see iw_cache_update()) and kept as the latest sample, which the scan
+ * thread copies as needed. Since the thread outlives the screens, switching
+ * screens leaves no gaps in the level history.
+ *
+ * The info screen consumes every sample, through a single-producer/single-
+ * consumer ring: the sampler only writes @head and the consumer only @tail,
+ * so neither side takes a lock. An eventfd is readable while samples are
+ * pending, for the consumer to wait on with poll(2).
+ */
+#include "iw_if.h"
+#include "iw_nl80211.h"
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+/* Number of samples that the ring holds, a power of 2. */
+#define SAMPLE_RING_SIZE	64
+
+/**
+ * struct sample_ring - ring of samples for one consumer
+ * @slot:     the samples, at index % %SAMPLE_RING_SIZE
+ * @head:     index of the next slot written by the sampler
+ * @tail:     index of the next slot read by the consumer
+ * @attached: whether there is a consumer; the sampler only writes if there is
+ * @dropped:  number of samples not written since the ring was full
+ * @efd:      eventfd, signalled for each sample written
+ */
+static struct sample_ring {
+	struct linkstat_sample	slot[SAMPLE_RING_SIZE];
+	atomic_uint		head,
+				tail;
+	atomic_bool		attached;
+	atomic_uint		dropped;
+	int			efd;
+} ring = { .efd = -1 };
+
+static pthread_t sampling_thread;
+static pthread_mutex_t sample_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sample_cond = PTHREAD_COND_INITIALIZER;
+static struct iw_nl80211_linkstat sample;	/* latest sample */
+static uint64_t sample_time;			/* CLOCK_MONOTONIC time of @sample, in ns */
+static uint32_t sample_gen;			/* number of samples taken */
+
+/* Append @ls, taken at @time, to the ring if a consumer is attached and there is room. */
+static void sample_ring_push(const struct iw_nl80211_linkstat *ls, uint64_t time)
+{
+	const unsigned head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+	const uint64_t one = 1;
+	struct linkstat_sample *s;
+
+	if (!atomic_load_explicit(&ring.attached, memory_order_acquire))
+		return;
+	if (head - atomic_load_explicit(&ring.tail, memory_order_acquire) == SAMPLE_RING_SIZE) {
+		atomic_fetch_add_explicit(&ring.dropped, 1, memory_order_relaxed);
+		return;
+	}
+	s       = ring.slot + head % SAMPLE_RING_SIZE;
+	s->ls   = *ls;
+	s->time = time;
+	/* Publish the slot before the consumer can see the new head. */
+	atomic_store_explicit(&ring.head, head + 1, memory_order_release);
+
+	if (write(ring.efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		err_sys("can not signal new sample");
+}
+
+static void *sampling_loop(void *arg)
+{
+	/* Too large for the stack of a thread that only sleeps otherwise. */
+	static struct iw_nl80211_linkstat ls;
+	struct timespec now;
+	uint64_t time;
+
+	(void)arg;
+	for (;;) {
+		iw_nl80211_get_linkstat(&ls);
+		iw_cache_update(&ls);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		time = now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+		sample_ring_push(&ls, time);
+
+		pthread_mutex_lock(&sample_mutex);
+		sample      = ls;
+		sample_time = time;
+		sample_gen++;
+		pthread_cond_broadcast(&sample_cond);
+		pthread_mutex_unlock(&sample_mutex);
+
+		/* A signal (e.g. SIGTSTP) only cuts the interval short: the thread runs for good. */
+		usleep(conf.stat_iv * 1000);
+	}
+	return NULL;
+}
+
+/** Start the sampling thread. */
+void sampling_init(void)
+{
+	sigset_t blockmask, oldmask;
+
+	ring.efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (ring.efd < 0)
+		err_sys("can not create sample eventfd");
+
+	/* SIGWINCH is supposed to be handled in the main thread. */
+	sigemptyset(&blockmask);
+	sigaddset(&blockmask, SIGWINCH);
+	pthread_sigmask(SIG_BLOCK, &blockmask, &oldmask);
+	if (pthread_create(&sampling_thread, NULL, sampling_loop, NULL))
+		err_sys("can not start sampling thread");
+	pthread_detach(sampling_thread);
+	pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+}
+
+/**
+ * Copy the latest sample into @ls if it is newer than sample number @gen, waiting
+ * for the first sample if there is none yet. If @when is not NULL, it is set to
+ * the time of the sample (CLOCK_MONOTONIC, in ns). Returns the sample number.
+ */
+uint32_t sampling_get(struct iw_nl80211_linkstat *ls, uint32_t gen, uint64_t *when)
+{
+	int cancel_state;
+
+	/* The scan thread may be cancelled, but must not exit holding the mutex. */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+	pthread_mutex_lock(&sample_mutex);
+	while (!sample_gen)
+		pthread_cond_wait(&sample_cond, &sample_mutex);
+	if (sample_gen != gen) {
+		*ls = sample;
+		gen = sample_gen;
+	}
+	if (when)
+		*when = sample_time;
+	pthread_mutex_unlock(&sample_mutex);
+	pthread_setcancelstate(cancel_state, NULL);
+	return gen;
+}
+
+/**
+ * Start consuming every sample from now on, through sampling_ring_pop().
+ * Returns a file descriptor that is readable while samples are pending.
+ */
+int sampling_ring_attach(void)
+{
+	uint64_t n;
+
+	/* Only the consumer moves @tail; the sampler does not write while detached. */
+	atomic_store_explicit(&ring.tail, atomic_load_explicit(&ring.head, memory_order_acquire),
+			      memory_order_relaxed);
+	atomic_store_explicit(&ring.dropped, 0, memory_order_relaxed);
+	if (read(ring.efd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+		err_sys("can not reset sample eventfd");
+	atomic_store_explicit(&ring.attached, true, memory_order_release);
+	return ring.efd;
+}
+
+/** Stop consuming samples. */
+void sampling_ring_detach(void)
+{
+	atomic_store_explicit(&ring.attached, false, memory_order_release);
+}
+
+/** Take the oldest pending sample into @s. Returns false if there is none. */
+bool sampling_ring_pop(struct linkstat_sample *s)
+{
+	const unsigned tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+	uint64_t n;
+
+	if (tail == atomic_load_explicit(&ring.head, memory_order_acquire)) {
+		/* Clear the eventfd; a sample written meanwhile signals it again. */
+		if (read(ring.efd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+			err_sys("can not read sample eventfd");
+		if (tail == atomic_load_explicit(&ring.head, memory_order_acquire))
+			return false;
+	}
+	*s = ring.slot[tail % SAMPLE_RING_SIZE];
+	/* Release the slot only after copying it. */
+	atomic_store_explicit(&ring.tail, tail + 1, memory_order_release);
+	return true;
+}
+
+/** Number of samples pending in the ring, and (in @dropped) those not written since it was full. */
+unsigned sampling_ring_depth(unsigned *dropped)
+{
+	*dropped = atomic_load_explicit(&ring.dropped, memory_order_relaxed);
+	return atomic_load_explicit(&ring.head, memory_order_acquire) -
+	       atomic_load_explicit(&ring.tail, memory_order_relaxed);
+}
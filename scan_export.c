@@ -0,0 +1,313 @@
+/*
+ * Non-interactive scan export, written while the scan dump is being parsed.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * JSON output consists of one object per scan and line, of the form
+ *   {"scan":1,"time":<unix time>,"interface":"wlan0","bss":[{...},...],"stale":false,
+ *    "color_collisions":[{"freq":<MHz>,"bss_color":<colour>,"count":<BSSes>},...],"timing":{...}}
+ * with a "position" after the interface if reading positions from gpsd.
+ * followed, if there was more than one scan, by {"profile":{"p50":{...},...}}.
+ * CSV output has a header line, followed by one line per BSS (and scan), and
+ * one line per BSS-colour collision of the scan, without BSSID, anomaly
+ * "color collision". Unknown values are null (JSON) or empty (CSV). BSSIDs never
+ * seen at this site before (see seen_filter.c) are flagged as "new".
+ *
+ * Since BSSes are written as they are parsed, colour collisions are counted
+ * per (channel, colour) and written at the end of the scan. Nontransmitted BSSes
+ * share the colour of their transmitting BSS, hence are not counted.
+ *
+ * If a scan keeps failing with a transient error, the results that the kernel
+ * holds from earlier scans are written instead, flagged as stale (JSON: with the
+ * "error" that prevented the scan), rather than giving up.
+ */
+#include "iw_scan.h"
+#include "iw_nl80211.h"
+
+/* Number of attempts to trigger a scan while the device is not ready. */
+#define EXPORT_RETRIES		10
+
+/* Number of channels on which BSS colours are counted. */
+#define EXPORT_COLOR_CHANS	128
+
+/**
+ * struct export_state - state of the export of one scan
+ * @format:     output format
+ * @scan:       sequence number of the scan (from 1)
+ * @num_bss:    number of BSSes written so far in this scan
+ * @stale:      whether the BSSes are from earlier scans, since this one failed
+ * @num_colors: number of valid entries in @colors
+ * @colors:     per channel, the number of BSSes using each BSS colour
+ */
+struct export_state {
+	enum scan_export_format	format;
+	int			scan;
+	size_t			num_bss;
+	bool			stale;
+	size_t			num_colors;
+	struct color_count {
+		uint32_t	freq;
+		int		chan;
+		uint16_t	count[64];
+	}			colors[EXPORT_COLOR_CHANS];
+};
+
+/* Machine-readable BSSID: lower case, with leading zeroes, irrespective of 'cisco_mac'. */
+static const char *export_addr(const struct ether_addr *ea)
+{
+	static char buf[3 * ETH_ALEN];
+	const uint8_t *a = ea->ether_addr_octet;
+
+	snprintf(buf, sizeof(buf), "%02x:%02x:%02x:%02x:%02x:%02x",
+		 a[0], a[1], a[2], a[3], a[4], a[5]);
+	return buf;
+}
+
+/* ESSIDs are printable ASCII (see print_ssid_escaped()), so only quotes and backslashes need escaping. */
+static void json_string(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			putchar('\\');
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+static void csv_string(const char *s)
+{
+	if (!strpbrk(s, ",\"")) {
+		fputs(s, stdout);
+		return;
+	}
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"')
+			putchar('"');
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+static void export_json(const struct scan_entry *e, const struct export_state *st)
+{
+	printf("%s{\"bssid\":\"%s\",\"essid\":", st->num_bss ? "," : "", export_addr(&e->ap_addr));
+	json_string(e->essid);
+	printf(",\"hidden\":%s", e->essid_hidden ? "true" : "false");
+	printf(",\"freq\":%u,\"chan\":%d", e->freq, e->chan);
+	if (e->bss_signal)
+		printf(",\"signal\":%d", e->bss_signal);
+	else
+		printf(",\"signal\":null");
+	printf(",\"last_seen_ms\":%u,\"encrypted\":%s,\"mesh\":%s",
+	       e->last_seen, e->has_key ? "true" : "false", e->mesh_enabled ? "true" : "false");
+	printf(",\"width\":%u,\"freq_ctr1\":%u,\"freq_ctr2\":%u",
+	       e->chan_width, e->freq_ctr1, e->freq_ctr2);
+	if (e->has_bss_load)
+		printf(",\"sta_count\":%u,\"chan_usage\":%u", e->bss_sta_count, e->bss_chan_usage);
+	else
+		printf(",\"sta_count\":null,\"chan_usage\":null");
+	if (e->bss_color && !e->bss_color_disabled)
+		printf(",\"bss_color\":%u", e->bss_color);
+	else
+		printf(",\"bss_color\":null");
+	if (e->twin_flags)
+		printf(",\"anomaly\":\"%s\"", twin_describe(e->twin_flags));
+	else
+		printf(",\"anomaly\":null");
+	printf(",\"new\":%s}", e->new_bss ? "true" : "false");
+}
+
+static void export_csv(const struct scan_entry *e, const struct export_state *st)
+{
+	printf("%d,%s,", st->scan, export_addr(&e->ap_addr));
+	csv_string(e->essid);
+	printf(",%d,%u,%d,", e->essid_hidden, e->freq, e->chan);
+	if (e->bss_signal)
+		printf("%d", e->bss_signal);
+	printf(",%u,%d,%d,%u,%u,%u,", e->last_seen, e->has_key, e->mesh_enabled,
+	       e->chan_width, e->freq_ctr1, e->freq_ctr2);
+	if (e->has_bss_load)
+		printf("%u,%u", e->bss_sta_count, e->bss_chan_usage);
+	else
+		putchar(',');
+	putchar(',');
+	if (e->bss_color && !e->bss_color_disabled)
+		printf("%u", e->bss_color);
+	putchar(',');
+	if (e->twin_flags)
+		csv_string(twin_describe(e->twin_flags));
+	printf(",%d,%d\n", e->new_bss, st->stale);
+}
+
+/* Count the BSS colour of @e, unless it has none or is a nontransmitted BSS. */
+static void count_color(struct export_state *st, const struct scan_entry *e)
+{
+	size_t i;
+
+	if (!e->bss_color || e->bss_color_disabled || e->mbssid_index)
+		return;
+	for (i = 0; i < st->num_colors && st->colors[i].freq != e->freq; i++)
+		;
+	if (i == EXPORT_COLOR_CHANS)
+		return;
+	if (i == st->num_colors) {
+		memset(st->colors + i, 0, sizeof(st->colors[i]));
+		st->colors[i].freq = e->freq;
+		st->colors[i].chan = e->chan;
+		st->num_colors++;
+	}
+	st->colors[i].count[e->bss_color & 63]++;
+}
+
+/* Write the BSS colours used by more than one BSS on the same channel. */
+static void export_collisions(const struct export_state *st)
+{
+	bool first = true;
+
+	if (st->format == SCAN_EXPORT_JSON)
+		printf(",\"color_collisions\":[");
+	for (size_t i = 0; i < st->num_colors; i++)
+		for (int c = 1; c < 64; c++) {
+			if (st->colors[i].count[c] < 2)
+				continue;
+			if (st->format == SCAN_EXPORT_JSON)
+				printf("%s{\"freq\":%u,\"bss_color\":%d,\"count\":%u}", first ? "" : ",",
+				       st->colors[i].freq, c, st->colors[i].count[c]);
+			else
+				printf("%d,,,,%u,%d,,,,,,,,,,%d,color collision,,%d\n", st->scan,
+				       st->colors[i].freq, st->colors[i].chan, c, st->stale);
+			first = false;
+		}
+	if (st->format == SCAN_EXPORT_JSON)
+		putchar(']');
+}
+
+/* Scan sink: write @e as soon as it has been parsed. */
+static void export_entry(const struct scan_entry *e, void *arg)
+{
+	struct export_state *st = arg;
+
+	count_color(st, e);
+
+	if (st->format == SCAN_EXPORT_JSON)
+		export_json(e, st);
+	else
+		export_csv(e, st);
+	st->num_bss++;
+}
+
+/* The current GPS position (null if there is no fix), as object member. */
+static void json_position(void)
+{
+	struct gps_fix fix;
+
+	gps_get_fix(&fix);
+	if (!fix.mode)
+		printf(",\"position\":null");
+	else if (fix.mode == 2)
+		printf(",\"position\":{\"lat\":%.7f,\"lon\":%.7f,\"alt\":null}", fix.lat, fix.lon);
+	else
+		printf(",\"position\":{\"lat\":%.7f,\"lon\":%.7f,\"alt\":%.1f}", fix.lat, fix.lon, fix.alt);
+}
+
+/* Write the &enum scan_prof_item values of @v as JSON object members. */
+static void json_timing(const uint32_t v[SP_NUM])
+{
+	putchar('{');
+	for (int i = 0; i < SP_NUM; i++) {
+		if (i == SP_RATE)
+			printf(",\"entries_per_s\":%u", v[i]);
+		else
+			printf("%s\"%s_ms\":%.3f", i ? "," : "", scan_prof_names[i], v[i] / 1e3);
+	}
+	putchar('}');
+}
+
+/* Rolling percentiles over all scans of this export. */
+static void json_profile(const struct scan_profile *p)
+{
+	static const int pcts[] = { 50, 90, 99 };
+	uint32_t v[SP_NUM];
+
+	printf("{\"profile\":{\"scans\":%u", p->count);
+	for (size_t k = 0; k < ARRAY_SIZE(pcts); k++) {
+		for (int i = 0; i < SP_NUM; i++)
+			v[i] = scan_profile_pct(p, i, pcts[k]);
+		printf(",\"p%d\":", pcts[k]);
+		json_timing(v);
+	}
+	printf("}}\n");
+}
+
+/** Run @count scans on the default interface, writing the results to stdout in @format. */
+void scan_export(enum scan_export_format format, int count)
+{
+	struct export_state st = { .format = format };
+	struct scan_profile profile = { .count = 0 };
+	struct scan_timing timing;
+	int ret, retries, error = 0;
+
+	if (format == SCAN_EXPORT_CSV)
+		printf("scan,bssid,essid,hidden,freq,chan,signal,last_seen_ms,encrypted,mesh,"
+		       "width,freq_ctr1,freq_ctr2,sta_count,chan_usage,bss_color,anomaly,new,stale\n");
+
+	for (st.scan = 1; st.scan <= count; st.scan++) {
+		st.num_bss    = 0;
+		st.num_colors = 0;
+		st.stale      = false;
+		if (format == SCAN_EXPORT_JSON) {
+			printf("{\"scan\":%d,\"time\":%lld,\"interface\":", st.scan, (long long)time(NULL));
+			json_string(conf_ifname());
+			if (gps_enabled())
+				json_position();
+			printf(",\"bss\":[");
+		}
+
+		for (retries = 0; retries < EXPORT_RETRIES; retries++) {
+			ret = scan_stream(export_entry, &st, &timing);
+			/* Transient errors; a partially written scan can not be retried. */
+			if (st.num_bss || (ret != -EAGAIN && ret != -EINTR &&
+					   ret != -EFAULT && ret != -ECANCELED))
+				break;
+			usleep(conf.stat_iv * 1000);
+		}
+
+		if (ret == -EPERM && !has_net_admin_capability())
+			err_quit("scanning requires CAP_NET_ADMIN permissions");
+		else if (ret < 0 && !st.num_bss && retries == EXPORT_RETRIES) {
+			/* Still busy: better stale results than none. */
+			error = ret;
+			st.stale = true;
+			memset(&timing, 0, sizeof(timing));
+			st.num_colors = 0;
+			ret = scan_stream_cached(export_entry, &st, &timing);
+		}
+		if (ret < 0)
+			err_quit("scan failed on %s: %s", conf_ifname(), strerror(-ret));
+
+		/* Stale results have not been scanned, hence do not count for the profile. */
+		if (!st.stale)
+			scan_profile_add(&profile, &timing, st.num_bss);
+		if (format == SCAN_EXPORT_JSON) {
+			printf("],\"stale\":%s", st.stale ? "true" : "false");
+			if (st.stale) {
+				printf(",\"error\":");
+				json_string(strerror(-error));
+			}
+			export_collisions(&st);
+			printf(",\"timing\":");
+			json_timing(timing.v);
+			printf("}\n");
+		} else {
+			export_collisions(&st);
+		}
+		if (fflush(stdout))
+			err_sys("can not write scan results");
+	}
+
+	if (format == SCAN_EXPORT_JSON && count > 1)
+		json_profile(&profile);
+	if (!seen_filter_sync(true))
+		err_msg("can not save the BSSIDs seen");
+}
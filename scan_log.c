@@ -0,0 +1,283 @@
+/*
+ * Geotagged scan log: every BSS of every scan, with the GPS position of the scan.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * The log is CSV if the file name ends in ".csv", else GeoJSON with one Feature
+ * per line and BSS (newline-delimited GeoJSON, as read by e.g. GDAL's GeoJSONSeq
+ * driver), whose geometry is null if there was no fix:
+ *
+ *   {"type":"Feature","geometry":{"type":"Point","coordinates":[<lon>,<lat>,<alt>]},
+ *    "properties":{"time":<unix time>,"bssid":"..","essid":"..","freq":<MHz>,...}}
+ *
+ * Both formats include the BSS colour, and whether it collides with that of
+ * another BSS on the same channel (see compute_color_collisions()).
+ *
+ * The scan thread only queues a copy of each scan. A writer thread writes the
+ * queue in batches, with one flush per batch. If the writer falls behind (e.g.
+ * on slow storage), scans are dropped rather than stalling the scan thread.
+ */
+#include "iw_scan.h"
+
+/* Number of queued scans beyond which further scans are dropped. */
+#define SCAN_LOG_MAX_QUEUE	64
+
+/* Number of queued scans that are written right away. */
+#define SCAN_LOG_BATCH		8
+
+/* Maximum time that a scan waits in the queue, in seconds. */
+#define SCAN_LOG_DELAY		2
+
+/**
+ * struct log_scan - a queued scan
+ * @next:    next scan in the write queue
+ * @time:    time that the scan completed
+ * @fix:     GPS position at @time
+ * @num_bss: length of @bss
+ * @bss:     copy of the scan entries
+ */
+struct log_scan {
+	struct log_scan		*next;
+	time_t			time;
+	struct gps_fix		fix;
+	size_t			num_bss;
+	struct log_bss {
+		struct ether_addr	addr;
+		char			essid[MAX_ESSID_LEN + 2];
+		uint32_t		freq;
+		int			chan;
+		int8_t			signal;
+		uint8_t			bss_color;	/* 0 if none */
+		bool			has_key,
+					color_collision;
+	}			bss[];
+};
+
+static FILE *log_fp;
+static bool log_csv;
+static pthread_t writer_thread;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct log_scan *queue_head, **queue_tail = &queue_head;
+static size_t queue_len, num_dropped;
+static bool writer_stop;
+
+static void log_addr(const struct ether_addr *ea)
+{
+	const uint8_t *a = ea->ether_addr_octet;
+
+	fprintf(log_fp, "%02x:%02x:%02x:%02x:%02x:%02x", a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+/* ESSIDs are printable ASCII (see print_ssid_escaped()), so only quotes and backslashes need escaping. */
+static void log_json_string(const char *s)
+{
+	fputc('"', log_fp);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', log_fp);
+		fputc(*s, log_fp);
+	}
+	fputc('"', log_fp);
+}
+
+static void log_csv_string(const char *s)
+{
+	if (!strpbrk(s, ",\"")) {
+		fputs(s, log_fp);
+		return;
+	}
+	fputc('"', log_fp);
+	for (; *s; s++) {
+		if (*s == '"')
+			fputc('"', log_fp);
+		fputc(*s, log_fp);
+	}
+	fputc('"', log_fp);
+}
+
+static void write_geojson(const struct log_scan *ls, const struct log_bss *b)
+{
+	fputs("{\"type\":\"Feature\",\"geometry\":", log_fp);
+	if (!ls->fix.mode)
+		fputs("null", log_fp);
+	else if (ls->fix.mode == 2)
+		fprintf(log_fp, "{\"type\":\"Point\",\"coordinates\":[%.7f,%.7f]}", ls->fix.lon, ls->fix.lat);
+	else
+		fprintf(log_fp, "{\"type\":\"Point\",\"coordinates\":[%.7f,%.7f,%.1f]}",
+			ls->fix.lon, ls->fix.lat, ls->fix.alt);
+
+	fprintf(log_fp, ",\"properties\":{\"time\":%lld,\"bssid\":\"", (long long)ls->time);
+	log_addr(&b->addr);
+	fputs("\",\"essid\":", log_fp);
+	log_json_string(b->essid);
+	fprintf(log_fp, ",\"freq\":%u,\"chan\":%d", b->freq, b->chan);
+	if (b->signal)
+		fprintf(log_fp, ",\"signal\":%d", b->signal);
+	else
+		fputs(",\"signal\":null", log_fp);
+	fprintf(log_fp, ",\"encrypted\":%s", b->has_key ? "true" : "false");
+	if (b->bss_color)
+		fprintf(log_fp, ",\"bss_color\":%u", b->bss_color);
+	else
+		fputs(",\"bss_color\":null", log_fp);
+	fprintf(log_fp, ",\"color_collision\":%s}}\n", b->color_collision ? "true" : "false");
+}
+
+static void write_csv(const struct log_scan *ls, const struct log_bss *b)
+{
+	fprintf(log_fp, "%lld,", (long long)ls->time);
+	if (ls->fix.mode)
+		fprintf(log_fp, "%.7f,%.7f,", ls->fix.lat, ls->fix.lon);
+	else
+		fputs(",,", log_fp);
+	if (ls->fix.mode == 3)
+		fprintf(log_fp, "%.1f", ls->fix.alt);
+	fputc(',', log_fp);
+	log_addr(&b->addr);
+	fputc(',', log_fp);
+	log_csv_string(b->essid);
+	fprintf(log_fp, ",%u,%d,", b->freq, b->chan);
+	if (b->signal)
+		fprintf(log_fp, "%d", b->signal);
+	fprintf(log_fp, ",%d,", b->has_key);
+	if (b->bss_color)
+		fprintf(log_fp, "%u", b->bss_color);
+	fprintf(log_fp, ",%d\n", b->color_collision);
+}
+
+static void *scan_log_writer(void *arg)
+{
+	struct log_scan *batch, *ls;
+	struct timespec deadline;
+
+	(void)arg;
+	pthread_mutex_lock(&queue_mutex);
+	for (;;) {
+		while (!queue_head && !writer_stop)
+			pthread_cond_wait(&queue_cond, &queue_mutex);
+		if (!queue_head)
+			break;
+
+		/* Collect a batch, but do not let the first scan wait for too long. */
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += SCAN_LOG_DELAY;
+		while (queue_len < SCAN_LOG_BATCH && !writer_stop &&
+		       pthread_cond_timedwait(&queue_cond, &queue_mutex, &deadline) != ETIMEDOUT)
+			;
+
+		batch      = queue_head;
+		queue_head = NULL;
+		queue_tail = &queue_head;
+		queue_len  = 0;
+
+		/* Write without holding the lock, so that the scan thread can continue to queue. */
+		pthread_mutex_unlock(&queue_mutex);
+		for (ls = batch; ls; ls = batch) {
+			for (size_t i = 0; i < ls->num_bss; i++)
+				if (log_csv)
+					write_csv(ls, ls->bss + i);
+				else
+					write_geojson(ls, ls->bss + i);
+			batch = ls->next;
+			free(ls);
+		}
+		if (fflush(log_fp))
+			err_sys("can not write scan log");
+		pthread_mutex_lock(&queue_mutex);
+	}
+	pthread_mutex_unlock(&queue_mutex);
+	return NULL;
+}
+
+/* Write pending scans on exit. */
+static void scan_log_fini(void)
+{
+	pthread_mutex_lock(&queue_mutex);
+	writer_stop = true;
+	pthread_cond_signal(&queue_cond);
+	pthread_mutex_unlock(&queue_mutex);
+
+	pthread_join(writer_thread, NULL);
+	fclose(log_fp);
+}
+
+/** Open the scan log at @path for appending, and start the writer. */
+void scan_log_init(const char *path)
+{
+	const size_t len = strlen(path);
+	sigset_t blockmask, oldmask;
+
+	log_csv = len > 4 && !strcasecmp(path + len - 4, ".csv");
+	log_fp  = fopen(path, "a");
+	if (!log_fp)
+		err_sys("can not open scan log %s", path);
+	/* Batches are written in one go. */
+	setvbuf(log_fp, NULL, _IOFBF, 1 << 16);
+	if (log_csv && ftell(log_fp) == 0)
+		fputs("time,lat,lon,alt,bssid,essid,freq,chan,signal,encrypted,bss_color,color_collision\n", log_fp);
+
+	/* SIGWINCH is supposed to be handled in the main thread. */
+	sigemptyset(&blockmask);
+	sigaddset(&blockmask, SIGWINCH);
+	pthread_sigmask(SIG_BLOCK, &blockmask, &oldmask);
+	pthread_create(&writer_thread, NULL, scan_log_writer, NULL);
+	pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+
+	atexit(scan_log_fini);
+}
+
+/**
+ * Queue the entries of @sr, tagged with @sr->fix, unless logging is disabled or
+ * the queue is full. Called by the scan thread; does not wait for any I/O.
+ */
+void scan_log_add(const struct scan_result *sr)
+{
+	struct log_scan *ls;
+	struct scan_entry *cur;
+	size_t n = 0;
+
+	if (!log_fp)
+		return;
+
+	ls = malloc(sizeof(*ls) + sr->num.entries * sizeof(ls->bss[0]));
+	if (!ls)
+		err_sys("unable to allocate scan log entry");
+	ls->next = NULL;
+	ls->time = time(NULL);
+	ls->fix  = sr->fix;
+	for (cur = sr->head; cur && n < sr->num.entries; cur = cur->next, n++) {
+		ls->bss[n].addr            = cur->ap_addr;
+		ls->bss[n].freq            = cur->freq;
+		ls->bss[n].chan            = cur->chan;
+		ls->bss[n].signal          = cur->bss_signal;
+		ls->bss[n].has_key         = cur->has_key;
+		ls->bss[n].bss_color       = cur->bss_color_disabled ? 0 : cur->bss_color;
+		ls->bss[n].color_collision = cur->color_collision;
+		memcpy(ls->bss[n].essid, cur->essid, sizeof(ls->bss[n].essid));
+	}
+	ls->num_bss = n;
+
+	pthread_mutex_lock(&queue_mutex);
+	if (queue_len < SCAN_LOG_MAX_QUEUE) {
+		*queue_tail = ls;
+		queue_tail  = &ls->next;
+		queue_len++;
+		pthread_cond_signal(&queue_cond);
+		ls = NULL;
+	} else {
+		num_dropped++;
+	}
+	pthread_mutex_unlock(&queue_mutex);
+	free(ls);
+}
+
+/** Number of scans not logged since the writer could not keep up. */
+size_t scan_log_dropped(void)
+{
+	size_t n;
+
+	pthread_mutex_lock(&queue_mutex);
+	n = num_dropped;
+	pthread_mutex_unlock(&queue_mutex);
+	return n;
+}
@@ -0,0 +1,85 @@
+/*
+ * Scan-engine profiler: per-scan stage timings and their rolling percentiles.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "iw_scan.h"
+
+const char *const scan_prof_names[SP_NUM] = {
+	[SP_TRIGGER]	= "trigger",
+	[SP_FIRMWARE]	= "firmware",
+	[SP_DUMP]	= "dump",
+	[SP_PARSE]	= "parse",
+	[SP_MERGE]	= "merge",
+	[SP_ANALYSE]	= "analyse",
+	[SP_SORT]	= "sort",
+	[SP_PUBLISH]	= "publish",
+	[SP_TOTAL]	= "total",
+	[SP_RATE]	= "entries/s",
+};
+
+/** Monotonic time in nanoseconds. */
+uint64_t prof_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** Return the microseconds elapsed since *@t, and advance *@t to now. */
+uint32_t prof_lap(uint64_t *t)
+{
+	const uint64_t now = prof_now(), lap = (now - *t) / 1000;
+
+	*t = now;
+	return lap > UINT32_MAX ? UINT32_MAX : lap;
+}
+
+/**
+ * Complete the derived items of @t (whose %SP_DUMP still includes the parsing),
+ * and add it to the rolling window of @p.
+ */
+void scan_profile_add(struct scan_profile *p, struct scan_timing *t, size_t entries)
+{
+	const uint32_t dump = t->v[SP_DUMP];
+	int i;
+
+	t->v[SP_PARSE] = t->parse_ns / 1000 < dump ? t->parse_ns / 1000 : dump;
+	t->v[SP_DUMP]  = dump - t->v[SP_PARSE];
+
+	t->v[SP_TOTAL] = 0;
+	for (i = SP_TRIGGER; i < SP_TOTAL; i++)
+		t->v[SP_TOTAL] += t->v[i];
+	t->v[SP_RATE] = dump ? entries * 1000000ULL / dump : 0;
+
+	/* PROF_WINDOW divides 2^32, so that wrap-around of @count does no harm. */
+	p->win[p->count++ % PROF_WINDOW] = *t;
+}
+
+/** Timing of the last scan recorded in @p (NULL if none). */
+const struct scan_timing *scan_profile_last(const struct scan_profile *p)
+{
+	return p->count ? p->win + (p->count - 1) % PROF_WINDOW : NULL;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	return (*(const uint32_t *)a > *(const uint32_t *)b) - (*(const uint32_t *)a < *(const uint32_t *)b);
+}
+
+/** Return the @pct percentile (nearest rank) of @item over the rolling window of @p. */
+uint32_t scan_profile_pct(const struct scan_profile *p, enum scan_prof_item item, int pct)
+{
+	const size_t n = p->count < PROF_WINDOW ? p->count : PROF_WINDOW;
+	uint32_t v[PROF_WINDOW];
+	size_t i, rank;
+
+	if (!n)
+		return 0;
+	for (i = 0; i < n; i++)
+		v[i] = p->win[i].v[item];
+	qsort(v, n, sizeof(*v), cmp_u32);
+
+	rank = (pct * n + 99) / 100;
+	return v[rank ? rank - 1 : 0];
+}
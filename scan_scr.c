@@ -20,12 +20,9 @@
 #include "iw_scan.h"
 
 /* GLOBALS */
-static struct scan_result sr = {
-	.head          = NULL,
-	.channel_stats = NULL,
-	.msg[0]        = '\0',
-};
-static pthread_t scan_thread;
+static struct scan_result *sr;		/* snapshot of the scan service */
+static struct scan_filter sf;
+static size_t num_markers;		/* site-survey markers dropped so far */
 static WINDOW *w_aplst;
 
 
@@ -92,6 +89,592 @@ static void fmt_scan_entry(struct scan_entry *cur, char buf[], size_t buflen)
 	if (cur->mesh_enabled) {
 		len += snprintf(buf + len, buflen - len, ", Mesh");
 	}
+	if (cur->essid_hidden && *cur->essid)
+		len += snprintf(buf + len, buflen - len, ", hidden%s",
+				cur->essid_cached ? " (cached)" : "");
+	if (cur->bss_color && !cur->bss_color_disabled)
+		len += snprintf(buf + len, buflen - len, ", colour %u%s", cur->bss_color,
+				cur->color_collision ? " COLLISION" : "");
+	if (cur->mbssid_tx)
+		len += snprintf(buf + len, buflen - len, ", MBSSID #%u%s", cur->mbssid_index,
+				cur->mbssid_synth ? " (profile)" : "");
+	else if (cur->mbssid_count)
+		len += snprintf(buf + len, buflen - len, ", MBSSID +%u", cur->mbssid_count);
+	if (cur->new_bss)
+		len += snprintf(buf + len, buflen - len, ", NEW");
+	if (cur->twin_flags)
+		snprintf(buf + len, buflen - len, ", TWIN? (%s)", twin_describe(cur->twin_flags));
+}
+
+/**
+ * struct row_text - formatted text of one row of the scan list
+ * @row:   index of the row that the text belongs to
+ * @gen:   value of @row_cache_gen when the text was formatted
+ * @col:   colour pair of the BSSID
+ * @bold:  whether @essid is shown in bold, before switching to @col
+ * @essid: ESSID column, padded to the column width
+ * @addr:  BSSID, as formatted by ether_addr()
+ * @info:  the rest of the row, as formatted by fmt_scan_entry()
+ */
+struct row_text {
+	size_t		row;
+	uint32_t	gen;
+	int		col;
+	bool		bold;
+	char		essid[MAX_ESSID_LEN + 4],
+			addr[sizeof("00:00:00:00:00:00")],
+			info[256];
+};
+
+/* Format the row of @cur into @rt. @member: @cur is shown as member of an expanded &scan_group. */
+static void fmt_row(struct row_text *rt, struct scan_entry *cur, bool member)
+{
+	if (!WLAN_CAPABILITY_IS_STA_BSS(cur->bss_capa) && (cur->bss_capa & WLAN_CAPABILITY_ESS)) {
+		rt->col = cur->has_key ? CP_RED : CP_GREEN;
+	} else {
+		rt->col = CP_YELLOW;
+	}
+
+	rt->bold = member || str_is_ascii(cur->essid);
+	if (member) {
+		/* The ESSID is already shown by the group header. */
+		sprintf(rt->essid, "   ");
+	} else if (!*cur->essid) {
+		rt->bold = false;
+		snprintf(rt->essid, sizeof(rt->essid), "%-*s ", sr->max_essid_len, "<hidden ESSID>");
+	} else if (rt->bold) {
+		snprintf(rt->essid, sizeof(rt->essid), "%-*s ", sr->max_essid_len, cur->essid);
+	} else {
+		snprintf(rt->essid, sizeof(rt->essid), "%-*s ", sr->max_essid_len, "<cryptic ESSID>");
+	}
+	snprintf(rt->addr, sizeof(rt->addr), "%s", ether_addr(&cur->ap_addr));
+	fmt_scan_entry(cur, rt->info, sizeof(rt->info));
+}
+
+/* Draw the row of @cur, formatted as @rt, at @line. @selected: @cur is at the cursor of the list. */
+static void draw_row(WINDOW *w_aplst, int line, const struct row_text *rt,
+		     const struct scan_entry *cur, bool selected)
+{
+	wmove(w_aplst, line, 1);
+	if (selected)
+		wattron(w_aplst, A_REVERSE);
+	if (rt->bold) {
+		waddstr_b(w_aplst, rt->essid);
+		wattron(w_aplst, COLOR_PAIR(rt->col));
+	} else {
+		wattron(w_aplst, COLOR_PAIR(rt->col));
+		waddstr(w_aplst, rt->essid);
+	}
+	/* Highlight BSSIDs never seen at this site before. */
+	if (cur->new_bss && !selected)
+		wadd_attr_str(w_aplst, A_REVERSE, rt->addr);
+	else
+		waddstr(w_aplst, rt->addr);
+
+	wattroff(w_aplst, COLOR_PAIR(rt->col));
+
+	waddstr(w_aplst, " ");
+	waddstr(w_aplst, rt->info);
+	if (selected)
+		wattroff(w_aplst, A_REVERSE);
+}
+
+/**
+ * Display a single scan entry at @line.
+ * @member:   entry is shown as member of an expanded &scan_group
+ * @selected: entry is at the cursor of the list
+ */
+static void display_entry(WINDOW *w_aplst, int line, struct scan_entry *cur, bool member, bool selected)
+{
+	struct row_text rt;
+
+	fmt_row(&rt, cur, member);
+	draw_row(w_aplst, line, &rt, cur, selected);
+}
+
+/*
+ * ESSID group mode
+ */
+static bool group_mode;
+static int group_cursor,		/* index of the selected group among those shown */
+	   group_vis;			/* number of groups shown */
+static size_t group_top,		/* line at the top of the screen */
+	      group_lines;		/* number of lines of all groups shown */
+static int group_height;		/* number of lines on the screen */
+static char group_selected[MAX_ESSID_LEN + 2];
+static bool group_has_selection;
+static char (*group_expanded)[MAX_ESSID_LEN + 2];
+static size_t num_group_expanded;
+
+static bool group_is_expanded(const char *essid)
+{
+	for (size_t i = 0; i < num_group_expanded; i++)
+		if (!strcmp(group_expanded[i], essid))
+			return true;
+	return false;
+}
+
+/* Expand the selected group if collapsed and vice versa. */
+static void group_toggle_selected(void)
+{
+	for (size_t i = 0; i < num_group_expanded; i++) {
+		if (!strcmp(group_expanded[i], group_selected)) {
+			strcpy(group_expanded[i], group_expanded[--num_group_expanded]);
+			return;
+		}
+	}
+	group_expanded = realloc(group_expanded, (num_group_expanded + 1) * sizeof(*group_expanded));
+	if (!group_expanded)
+		err_sys("unable to allocate expanded ESSID group");
+	strcpy(group_expanded[num_group_expanded++], group_selected);
+}
+
+/* Summary line of @grp: number of BSSIDs, signal range, bands and channels passing the filter. */
+static void display_group(WINDOW *w_aplst, int line, struct scan_group *grp, bool selected)
+{
+	const char *essid = grp->members->essid;
+	const struct group_stats *gs = &grp->shown;
+	char s[256];
+	size_t len;
+
+	wmove(w_aplst, line, 1);
+	wadd_attr_str(w_aplst, selected ? A_REVERSE : 0, grp->expanded ? "[-]" : "[+]");
+	waddch(w_aplst, ' ');
+	if (!*essid)
+		essid = "<hidden ESSID>";
+	else if (!str_is_ascii(grp->members->essid))
+		essid = "<cryptic ESSID>";
+	sprintf(s, "%-*s ", sr->max_essid_len, essid);
+	waddstr_b(w_aplst, s);
+
+	len = sprintf(s, "%3u BSSID%s", gs->count, gs->count == 1 ? ", " : "s,");
+	if (!gs->sig_max)
+		len += sprintf(s + len, " ? dBm");
+	else if (gs->sig_max == gs->sig_min)
+		len += sprintf(s + len, " %d dBm", gs->sig_max);
+	else
+		len += sprintf(s + len, " %d..%d dBm", gs->sig_max, gs->sig_min);
+
+	len += sprintf(s + len, ", %s",
+		       gs->bands == (SF_BAND_2G | SF_BAND_5G) ? "2.4/5 GHz" :
+		       gs->bands == SF_BAND_2G ? "2.4 GHz" : "5 GHz");
+
+	for (int i = 0; i < gs->num_chans && i < MAX_GROUP_CHANS; i++)
+		len += sprintf(s + len, "%s%d", i ? "," : ", ch ", gs->chans[i]);
+	if (gs->num_chans > MAX_GROUP_CHANS)
+		sprintf(s + len, ",+%d", gs->num_chans - MAX_GROUP_CHANS);
+	waddstr(w_aplst, s);
+}
+
+/* Move the group cursor by @delta groups, stopping at either end. */
+static void group_move(long delta)
+{
+	if (delta < 0 && -delta > group_cursor)
+		group_cursor = 0;
+	else if (delta > 0 && group_cursor + delta >= group_vis)
+		group_cursor = group_vis ? group_vis - 1 : 0;
+	else
+		group_cursor += delta;
+}
+
+/*
+ * Display the lines of groups with at least one entry passing the filter from
+ * @group_top that fit above @max_line, scrolled to the cursor. Returns next line.
+ */
+static int display_groups(WINDOW *w_aplst, int line, int max_line)
+{
+	struct scan_group *grp;
+	struct scan_entry *cur;
+	size_t n, cursor_line = 0;
+	int vis = 0;
+
+	group_has_selection = false;
+	group_height = max_line - line;
+	if (group_height <= 0)
+		return line;
+
+	/* Line of the selected group, keeping the cursor on the last group shown. */
+	for (n = 0, grp = sr->groups; grp < sr->groups + sr->num.groups; grp++) {
+		if (!grp->shown.count)
+			continue;
+		grp->expanded = group_is_expanded(grp->members->essid);
+		if (vis++ <= group_cursor)
+			cursor_line = n;
+		n += 1 + (grp->expanded ? grp->shown.count : 0);
+	}
+	group_vis   = vis;
+	group_lines = n;
+	if (!vis)
+		return line;
+	if (group_cursor >= vis)
+		group_cursor = vis - 1;
+
+	if (cursor_line < group_top)
+		group_top = cursor_line;
+	else if (cursor_line >= group_top + group_height)
+		group_top = cursor_line - group_height + 1;
+	/* Do not leave empty lines at the bottom when the groups shrink. */
+	if (group_top + group_height > group_lines)
+		group_top = group_lines > (size_t)group_height ? group_lines - group_height : 0;
+
+	for (n = 0, vis = 0, grp = sr->groups; grp < sr->groups + sr->num.groups && line < max_line; grp++) {
+		if (!grp->shown.count)
+			continue;
+		if (vis == group_cursor) {
+			strcpy(group_selected, grp->members->essid);
+			group_has_selection = true;
+		}
+		if (n++ >= group_top)
+			display_group(w_aplst, line++, grp, vis == group_cursor);
+		vis++;
+
+		for (cur = grp->members; grp->expanded && cur && line < max_line; cur = cur->group_next)
+			if (cur->filtered && n++ >= group_top)
+				display_entry(w_aplst, line++, cur, true, false);
+	}
+	return line;
+}
+
+/*
+ * Scrolling list: only the rows on the screen are drawn.
+ */
+static struct scan_entry **rows;	/* entries passing the filter, in display order */
+static size_t num_rows, rows_alloc;
+static size_t list_top,			/* row at the top of the screen */
+	      list_cursor;		/* selected row */
+static int list_height;			/* number of rows on the screen */
+static struct ether_addr list_selected;	/* BSSID of the selected row, kept across scans */
+
+/*
+ * Text of the rows on the screen, in slot @row % %ROW_CACHE_SLOTS, so that a row is
+ * only formatted again after the snapshot, the filter, or the layout has changed.
+ */
+#define ROW_CACHE_SLOTS		256
+static struct row_text row_cache[ROW_CACHE_SLOTS];
+static uint32_t row_cache_gen = 1;	/* 0 marks unused slots */
+static int row_cache_cisco_mac;
+static uint16_t row_cache_essid_len;
+
+/* Index the entries that pass the filter, keeping the cursor on the selected BSSID. */
+static void list_rebuild(void)
+{
+	struct scan_entry *cur;
+
+	row_cache_gen++;
+	num_rows = 0;
+	for (cur = sr->head; cur; cur = cur->next) {
+		if (!cur->filtered)
+			continue;
+		if (num_rows == rows_alloc) {
+			rows_alloc = rows_alloc ? 2 * rows_alloc : 256;
+			rows = realloc(rows, rows_alloc * sizeof(*rows));
+			if (!rows)
+				err_sys("unable to allocate scan list");
+		}
+		if (!memcmp(&cur->ap_addr, &list_selected, sizeof(list_selected)))
+			list_cursor = num_rows;
+		rows[num_rows++] = cur;
+	}
+}
+
+/* Move the cursor by @delta rows, stopping at either end. */
+static void list_move(long delta)
+{
+	if (delta < 0 && (size_t)-delta > list_cursor)
+		list_cursor = 0;
+	else if (delta > 0 && list_cursor + delta >= num_rows)
+		list_cursor = num_rows ? num_rows - 1 : 0;
+	else
+		list_cursor += delta;
+}
+
+/* Display the rows from @list_top that fit above @max_line, scrolled to the cursor. Returns next line. */
+static int display_list(WINDOW *w_aplst, int line, int max_line)
+{
+	list_height = max_line - line;
+	if (!num_rows || list_height <= 0)
+		return line;
+
+	if (list_cursor >= num_rows)
+		list_cursor = num_rows - 1;
+	if (list_cursor < list_top)
+		list_top = list_cursor;
+	else if (list_cursor >= list_top + list_height)
+		list_top = list_cursor - list_height + 1;
+	/* Do not leave empty lines at the bottom when the list shrinks. */
+	if (list_top + list_height > num_rows)
+		list_top = num_rows > (size_t)list_height ? num_rows - list_height : 0;
+	list_selected = rows[list_cursor]->ap_addr;
+
+	if (conf.cisco_mac != row_cache_cisco_mac || sr->max_essid_len != row_cache_essid_len) {
+		row_cache_cisco_mac = conf.cisco_mac;
+		row_cache_essid_len = sr->max_essid_len;
+		row_cache_gen++;
+	}
+	for (size_t i = list_top; i < num_rows && line < max_line; i++) {
+		struct row_text *rt = row_cache + i % ROW_CACHE_SLOTS;
+
+		if (rt->gen != row_cache_gen || rt->row != i) {
+			fmt_row(rt, rows[i], false);
+			rt->gen = row_cache_gen;
+			rt->row = i;
+		}
+		draw_row(w_aplst, line++, rt, rows[i], i == list_cursor);
+	}
+	return line;
+}
+
+/*
+ * Roaming panel
+ */
+static bool roam_mode;
+
+/* Maximum number of roaming candidates listed in the panel. */
+#define MAX_ROAM_LINES	4
+/* Advantage in dB above which a roaming candidate is considered clearly better. */
+#define ROAM_THRESHOLD	6
+
+/* Number of lines taken by the roaming panel. */
+static int roam_panel_height(void)
+{
+	if (!roam_mode)
+		return 0;
+	return 1 + (sr->num.roam < MAX_ROAM_LINES ? sr->num.roam : MAX_ROAM_LINES);
+}
+
+/* List the best other BSSIDs of the associated ESSID, starting at @line. */
+static void display_roam_panel(WINDOW *w_aplst, int line)
+{
+	const struct scan_entry *cur = sr->roam_cur;
+	char s[256];
+
+	wmove(w_aplst, line++, 1);
+	wadd_attr_str(w_aplst, A_REVERSE, "roaming:");
+	if (!cur) {
+		waddstr(w_aplst, " not associated, or associated BSS not in scan results");
+		return;
+	}
+	sprintf(s, " %s", *cur->essid ? cur->essid : "<hidden ESSID>");
+	waddstr_b(w_aplst, curtail(s, "~", sr->max_essid_len + 1));
+	sprintf(s, " %s ch %d, %d dBm, %zu other BSSID%s", ether_addr(&cur->ap_addr),
+		cur->chan, sr->link.signal, sr->num.roam, sr->num.roam == 1 ? "" : "s");
+	waddstr(w_aplst, s);
+
+	for (size_t i = 0; i < sr->num.roam && i < MAX_ROAM_LINES; i++) {
+		const struct roam_candidate *rc = sr->roam + i;
+		int col = rc->score >= ROAM_THRESHOLD ? CP_GREEN :
+			  rc->score > 0               ? CP_YELLOW : CP_STANDARD;
+		size_t len;
+
+		wmove(w_aplst, line++, 1);
+		sprintf(s, "%2zu. %+5.1f dB", i + 1, rc->score);
+		wadd_attr_str(w_aplst, COLOR_PAIR(col) | A_BOLD, s);
+
+		cur = rc->entry;
+		len = sprintf(s, "  %s ch %3d, %d dBm", ether_addr(&cur->ap_addr),
+			      cur->chan, cur->bss_signal);
+		if (cur->has_bss_load)
+			len += sprintf(s + len, ", %u sta, %.0f%% chan", cur->bss_sta_count,
+				       (1e2 * cur->bss_chan_usage)/2.55e2);
+		if (cur->rm_enabled || (cur->bss_capa & WLAN_CAPABILITY_RADIO_MEASURE))
+			sprintf(s + len, ", RM");
+		waddstr(w_aplst, s);
+	}
+}
+
+/*
+ * Channel-plan panel
+ */
+static bool plan_mode;
+
+/* Maximum number of recommended channels listed in the panel. */
+#define MAX_PLAN_LINES	4
+
+/* Number of lines taken by the channel-plan panel. */
+static int plan_panel_height(void)
+{
+	if (!plan_mode)
+		return 0;
+	return 1 + (sr->num.plan < MAX_PLAN_LINES ? sr->num.plan : MAX_PLAN_LINES);
+}
+
+/* List the lowest-cost channels/widths, starting at @line. */
+static void display_plan_panel(WINDOW *w_aplst, int line)
+{
+	char s[256];
+
+	wmove(w_aplst, line++, 1);
+	wadd_attr_str(w_aplst, A_REVERSE, "channel plan:");
+	sprintf(s, " %zu candidate channels", sr->num.plan);
+	waddstr(w_aplst, s);
+	if (*sr->plan_country) {
+		sprintf(s, ", regulatory domain %s", sr->plan_country);
+		waddstr(w_aplst, s);
+	}
+
+	for (size_t i = 0; i < sr->num.plan && i < MAX_PLAN_LINES; i++) {
+		const struct chan_candidate *cc = sr->plan + i;
+		const int lo = ieee80211_frequency_to_channel(cc->freq_ctr - cc->width / 2 + 10),
+			  hi = ieee80211_frequency_to_channel(cc->freq_ctr + cc->width / 2 - 10);
+		size_t len;
+
+		wmove(w_aplst, line++, 1);
+		if (lo == hi)
+			sprintf(s, "%2zu. ch %d", i + 1, lo);
+		else
+			sprintf(s, "%2zu. ch %d-%d", i + 1, lo, hi);
+		wadd_attr_str(w_aplst, A_BOLD, s);
+
+		len = sprintf(s, ", %u MHz (%s %u MHz), cost %.2f", cc->width,
+			      cc->freq_ctr < 2500 ? "2.4 GHz," : cc->freq_ctr < 5950 ? "5 GHz," : "6 GHz,",
+			      cc->freq_ctr, cc->cost);
+		if (cc->busy > 0)
+			len += sprintf(s + len, ", %.0f%% busy", 1e2 * cc->busy);
+		if (cc->flags & CP_DFS)
+			len += sprintf(s + len, ", DFS");
+		if (cc->flags & CP_NO_IR)
+			sprintf(s + len, ", no-IR");
+		waddstr(w_aplst, s);
+	}
+}
+
+/*
+ * Evil-twin and new-BSSID events panel
+ */
+static bool events_mode;
+
+/* Maximum number of events listed in the panel. */
+#define MAX_EVENT_LINES	4
+
+/* Number of lines taken by the events panel. */
+static int events_panel_height(void)
+{
+	if (!events_mode)
+		return 0;
+	return 1 + (sr->events.count < MAX_EVENT_LINES ? sr->events.count : MAX_EVENT_LINES);
+}
+
+/* List the latest events, newest first, starting at @line. */
+static void display_events_panel(WINDOW *w_aplst, int line)
+{
+	char s[256], ts[16];
+
+	wmove(w_aplst, line++, 1);
+	wadd_attr_str(w_aplst, A_REVERSE, "alerts:");
+	sprintf(s, " %u so far, %zu twin%s, %zu new current", sr->events.count,
+		sr->num.twins, sr->num.twins == 1 ? "" : "s", sr->num.new_bss);
+	waddstr(w_aplst, s);
+
+	for (uint32_t i = 0; i < sr->events.count && i < MAX_EVENT_LINES; i++) {
+		const struct scan_event *ev = sr->events.ev + (sr->events.count - 1 - i) % MAX_SCAN_EVENTS;
+
+		strftime(ts, sizeof(ts), "%H:%M:%S", localtime(&ev->time));
+		wmove(w_aplst, line++, 1);
+		sprintf(s, "%s %s ", ts, ether_addr(&ev->addr));
+		waddstr(w_aplst, s);
+		wadd_attr_str(w_aplst, A_BOLD, str_is_ascii(ev->essid) ? ev->essid : "<cryptic ESSID>");
+		if (ev->twin_flags) {
+			sprintf(s, ": unusual %s", twin_describe(ev->twin_flags));
+			wadd_attr_str(w_aplst, COLOR_PAIR(CP_RED), s);
+		} else {
+			wadd_attr_str(w_aplst, COLOR_PAIR(CP_YELLOW), ": new BSSID");
+		}
+	}
+}
+
+/* Width of the per-channel occupancy bars. */
+#define OCC_BAR_LEN	3
+
+/*
+ * Channel-occupancy line: each 20 MHz channel overlapped by a BSS is shown with a
+ * bar whose length/colour reflect its interference score (green < 1 <= yellow < 2).
+ */
+static void display_occupancy(WINDOW *w_aplst, int line)
+{
+	int8_t cscale[2] = { 1, 2 };
+	char s[16];
+
+	wmove(w_aplst, line, 1);
+	wadd_attr_str(w_aplst, A_REVERSE, "occupancy:");
+
+	for (size_t i = 0; i < sr->num.occupancy; i++) {
+		const struct chan_occupancy *occ = sr->occupancy + i;
+		int len;
+
+		if ((conf.scan_filter_band == SCAN_FILTER_BAND_2G && occ->freq >= 2500) ||
+		    (conf.scan_filter_band == SCAN_FILTER_BAND_5G && occ->freq < 2500))
+			continue;
+
+		len = sprintf(s, " %d", occ->chan);
+		if (getcurx(w_aplst) + len + OCC_BAR_LEN > MAXXLEN)
+			break;
+		waddstr(w_aplst, s);
+		len = clamp(ceil(occ->score), 1, OCC_BAR_LEN);
+		whline(w_aplst, '=' | A_BOLD | cp_from_scale(occ->score, cscale, false), len);
+		wmove(w_aplst, line, getcurx(w_aplst) + OCC_BAR_LEN);
+	}
+}
+
+/*
+ * Scan-profile overlay
+ */
+static bool prof_mode;
+
+/* Width of the overlay, which is drawn over the top right of the list. */
+#define PROF_OVERLAY_WIDTH	46
+
+/* Append @v of @item to @s: milliseconds for stages, entries/s for the rate. */
+static int fmt_prof(char *s, enum scan_prof_item item, uint32_t v)
+{
+	if (item == SP_RATE)
+		return sprintf(s, "%8u", v);
+	return sprintf(s, "%8.1f", v / 1e3);
+}
+
+static void display_profile(WINDOW *w_aplst)
+{
+	static const int pcts[] = { 50, 90, 99 };
+	const struct scan_timing *last = scan_profile_last(&sr->profile);
+	const int x = MAXXLEN - PROF_OVERLAY_WIDTH + 1;
+	char s[128];
+	int i, len;
+
+	sprintf(s, " %-12s%8s%8s%8s%8s ", "scan [ms]", "last", "p50", "p90", "p99");
+	wmove(w_aplst, 1, x);
+	wadd_attr_str(w_aplst, A_REVERSE, s);
+	if (!last) {
+		sprintf(s, " %-*s", PROF_OVERLAY_WIDTH - 1, "no scan completed yet");
+		mvwaddstr(w_aplst, 2, x, s);
+		return;
+	}
+
+	for (i = 0; i < SP_NUM; i++) {
+		len = sprintf(s, " %-12s", scan_prof_names[i]);
+		len += fmt_prof(s + len, i, last->v[i]);
+		for (size_t k = 0; k < ARRAY_SIZE(pcts); k++)
+			len += fmt_prof(s + len, i, scan_profile_pct(&sr->profile, i, pcts[k]));
+		sprintf(s + len, " ");
+		wmove(w_aplst, 2 + i, x);
+		wadd_attr_str(w_aplst, i == SP_TOTAL ? A_BOLD : A_NORMAL, s);
+	}
+	len = sprintf(s, " over the last %u scans",
+		      sr->profile.count < PROF_WINDOW ? sr->profile.count : PROF_WINDOW);
+	sprintf(s + len, "%*s", PROF_OVERLAY_WIDTH - len, "");
+	mvwaddstr(w_aplst, 2 + SP_NUM, x, s);
+
+	if (!conf.scan_defer)
+		return;
+	len = sprintf(s, " deferred %.1fs, off-channel %.1fs avoided",
+		      sr->defer.deferred_ms / 1e3, sr->defer.avoided_ms / 1e3);
+	sprintf(s + len, "%*s", PROF_OVERLAY_WIDTH - len, "");
+	mvwaddstr(w_aplst, 3 + SP_NUM, x, s);
+	len = sprintf(s, " %u sweeps under traffic, link %u kbit/s", sr->defer.low_prio, sr->defer.kbps);
+	sprintf(s + len, "%*s", PROF_OVERLAY_WIDTH - len, "");
+	mvwaddstr(w_aplst, 4 + SP_NUM, x, s);
+	len = sprintf(s, " tx retries/s: %.1f scanning, %.1f idle",
+		      sr->defer.retry_scan, sr->defer.retry_idle);
+	sprintf(s + len, "%*s", PROF_OVERLAY_WIDTH - len, "");
+	mvwaddstr(w_aplst, 5 + SP_NUM, x, s);
 }
 
 static void display_aplist(WINDOW *w_aplst)
@@ -106,56 +689,63 @@ static void display_aplist(WINDOW *w_aplst)
 		[SO_CHAN_SIG] = "Ch/Sg",
 		[SO_OPEN_SIG] = "Op/Sg"
 	};
-	int i, col, line = 1;
-	struct scan_entry *cur;
+	static uint32_t sr_generation, sf_generation;
+	static size_t num_shown;
+	int i, line = 1, first_line, max_line;
 
 	/* Scanning can take several seconds - do not refresh while locked. */
-	if (pthread_mutex_trylock(&sr.mutex))
+	if (pthread_mutex_trylock(&sr->mutex))
 		return;
 
-	if (sr.head || *sr.msg)
+	/* Re-evaluate the filter only when the snapshot or the filter changed. */
+	scan_filter_sync(&sf);
+	if (sr->generation != sr_generation || sf.generation != sf_generation) {
+		num_shown     = scan_filter_apply(sr, &sf);
+		list_rebuild();
+		sr_generation = sr->generation;
+		sf_generation = sf.generation;
+	}
+
+	if (sr->head || *sr->msg)
 		for (i = 1; i <= MAXYLEN; i++)
 			mvwclrtoborder(w_aplst, i, 1);
 
-	if (!sr.head)
-		waddstr_center(w_aplst, WAV_HEIGHT/2 - 1, sr.msg);
+	if (!sr->head)
+		waddstr_center(w_aplst, WAV_HEIGHT/2 - 1, sr->msg);
+	else if (!num_shown)
+		waddstr_center(w_aplst, WAV_HEIGHT/2 - 1, "No scan entries match the current filter");
 
-	/* Truncate overly long access point lists to match screen height. */
-	for (cur = sr.head; cur && line < MAXYLEN; cur = cur->next) {
-		if (!conf.scan_hidden_essids && !*cur->essid)
-			continue;
-
-		if (!WLAN_CAPABILITY_IS_STA_BSS(cur->bss_capa) && (cur->bss_capa & WLAN_CAPABILITY_ESS)) {
-			col = cur->has_key ? CP_RED : CP_GREEN;
-		} else {
-			col = CP_YELLOW;
-		}
-
-		wmove(w_aplst, line, 1);
-		if (!*cur->essid) {
-			sprintf(s, "%-*s ", sr.max_essid_len, "<hidden ESSID>");
-			wattron(w_aplst, COLOR_PAIR(col));
-			waddstr(w_aplst, s);
-		} else if (str_is_ascii(cur->essid)) {
-			sprintf(s, "%-*s ", sr.max_essid_len, cur->essid);
-			waddstr_b(w_aplst, s);
-			wattron(w_aplst, COLOR_PAIR(col));
-		} else {
-			sprintf(s, "%-*s ", sr.max_essid_len, "<cryptic ESSID>");
-			wattron(w_aplst, COLOR_PAIR(col));
-			waddstr(w_aplst, s);
-		}
-		waddstr(w_aplst, ether_addr(&cur->ap_addr));
+	/* The last scan failed: show its error above the previous results. */
+	if (sr->stale) {
+		wmove(w_aplst, line++, 1);
+		sprintf(s, "stale (%s old):", pretty_time(time(NULL) - sr->updated));
+		wadd_attr_str(w_aplst, COLOR_PAIR(CP_RED) | A_REVERSE, s);
+		waddch(w_aplst, ' ');
+		waddstr(w_aplst, sr->msg);
+	}
+	first_line = line;
 
-		wattroff(w_aplst, COLOR_PAIR(col));
+	/* Scroll overly long access point lists within the screen height. */
+	max_line = (sr->num.occupancy ? MAXYLEN - 1 : MAXYLEN) - roam_panel_height() -
+		   plan_panel_height() - events_panel_height();
+	if (group_mode)
+		line = display_groups(w_aplst, line, max_line);
+	else
+		line = display_list(w_aplst, line, max_line);
 
-		fmt_scan_entry(cur, s, sizeof(s));
-		waddstr(w_aplst, " ");
-		waddstr(w_aplst, s);
-		line++;
-	}
+	if (prof_mode && sr->head)
+		display_profile(w_aplst);
+	if (roam_mode && sr->head)
+		display_roam_panel(w_aplst, max_line);
+	if (plan_mode && sr->head)
+		display_plan_panel(w_aplst, max_line + roam_panel_height());
+	if (events_mode && sr->head)
+		display_events_panel(w_aplst, max_line + roam_panel_height() + plan_panel_height());
+	if (sr->num.occupancy)
+		display_occupancy(w_aplst, max_line + roam_panel_height() + plan_panel_height() +
+				  events_panel_height());
 
-	if (sr.num.entries < MAX_CH_STATS)
+	if (sr->num.entries < MAX_CH_STATS)
 		goto done;
 
 	wmove(w_aplst, MAXYLEN, 1);
@@ -166,74 +756,199 @@ static void display_aplist(WINDOW *w_aplst)
 	} else {
 		wadd_attr_str(w_aplst, A_REVERSE, "total:");
 	}
-	sprintf(s, " %d ", sr.num.entries);
+	if (num_shown != sr->num.entries)
+		sprintf(s, " %zu/%u ", num_shown, sr->num.entries);
+	else
+		sprintf(s, " %u ", sr->num.entries);
 	waddstr(w_aplst, s);
+	/* Several BSSes can share one radio (Multiple BSSID). */
+	if (sr->num.physical != sr->num.entries) {
+		sprintf(s, "on %zu APs ", sr->num.physical);
+		waddstr(w_aplst, s);
+	}
 
 	sprintf(s, "%s %ssc", sort_type[conf.scan_sort_order], conf.scan_sort_asc ? "a" : "de");
 	wadd_attr_str(w_aplst, A_REVERSE, s);
 
-	if (line == MAXYLEN && sr.num.entries > line - 1) {
-		/* Truncated display truncated. Need to subtract 1 for the status line at the bottom. */
-		sprintf(s, ", %d not shown", sr.num.entries - (line - 1));
+	if (group_mode) {
+		if (group_lines > (size_t)(line - first_line))
+			sprintf(s, ", ESSID #%d of %d", group_cursor + 1, group_vis);
+		else
+			sprintf(s, ", %d ESSIDs", group_vis);
+		waddstr(w_aplst, s);
+	} else if (num_rows > (size_t)(line - first_line)) {
+		/* Not all rows fit on the screen: show the position of the cursor. */
+		sprintf(s, ", #%zu, rows %zu-%zu", list_cursor + 1, list_top + 1, list_top + line - first_line);
 		waddstr(w_aplst, s);
 	}
-	if (sr.num.open) {
-		sprintf(s, ", %d open", sr.num.open);
+	if (sr->num.open) {
+		sprintf(s, ", %u open", sr->num.open);
 		waddstr(w_aplst, s);
 	}
-	if (sr.num.hidden) {
-		sprintf(s, ", %d hidden", sr.num.hidden);
+	if (sr->num.hidden) {
+		sprintf(s, ", %u hidden", sr->num.hidden);
 		waddstr(w_aplst, s);
 	}
+	if (sr->num.unveiled) {
+		sprintf(s, ", %zu unveiled", sr->num.unveiled);
+		waddstr(w_aplst, s);
+	}
+	if (sr->num.color_collisions) {
+		waddstr(w_aplst, ", ");
+		sprintf(s, "%zu colour clash", sr->num.color_collisions);
+		wadd_attr_str(w_aplst, COLOR_PAIR(CP_RED) | A_BOLD, s);
+	}
+	if (sr->num.twins) {
+		waddstr(w_aplst, ", ");
+		sprintf(s, "%zu twin alert%s", sr->num.twins, sr->num.twins == 1 ? "" : "s");
+		wadd_attr_str(w_aplst, COLOR_PAIR(CP_RED) | A_BOLD, s);
+	}
+	if (sr->num.new_bss) {
+		waddstr(w_aplst, ", ");
+		sprintf(s, "%zu new", sr->num.new_bss);
+		wadd_attr_str(w_aplst, COLOR_PAIR(CP_YELLOW) | A_BOLD, s);
+	}
 
 
-	if (sr.num.two_gig && sr.num.five_gig) {
+	if (sr->num.two_gig && sr->num.five_gig) {
 		waddch(w_aplst, ' ');
 		wadd_attr_str(w_aplst, A_REVERSE, "5/2GHz:");
-		sprintf(s, " %d/%d", sr.num.five_gig, sr.num.two_gig);
+		sprintf(s, " %u/%u", sr->num.five_gig, sr->num.two_gig);
 		waddstr(w_aplst, s);
 	}
 
-	if (sr.channel_stats) {
+	if (sr->channel_stats) {
 		waddch(w_aplst, ' ');
 		if (conf.scan_sort_order == SO_CHAN && !conf.scan_sort_asc)
-			sprintf(s, "bottom-%d:", (int)sr.num.ch_stats);
+			sprintf(s, "bottom-%d:", (int)sr->num.ch_stats);
 		else
-			sprintf(s, "top-%d:", (int)sr.num.ch_stats);
+			sprintf(s, "top-%d:", (int)sr->num.ch_stats);
 		wadd_attr_str(w_aplst, A_REVERSE, s);
 
-		for (size_t i = 0; i < sr.num.ch_stats; i++) {
+		for (size_t i = 0; i < sr->num.ch_stats; i++) {
 			waddstr(w_aplst, i ? ", " : " ");
-			sprintf(s, "ch#%d", sr.channel_stats[i].val);
+			sprintf(s, "ch#%d", sr->channel_stats[i].val);
 			wadd_attr_str(w_aplst, A_BOLD, s);
-			sprintf(s, " (%d)", sr.channel_stats[i].count);
+			sprintf(s, " (%d)", sr->channel_stats[i].count);
 			waddstr(w_aplst, s);
 		}
 	}
+
+	if (sr->num.radios > 1) {
+		sprintf(s, ", %zu radios", sr->num.radios);
+		waddstr(w_aplst, s);
+	}
+	if (num_markers) {
+		sprintf(s, ", %zu marker%s", num_markers, num_markers == 1 ? "" : "s");
+		waddstr(w_aplst, s);
+	}
+	if (gps_enabled()) {
+		if (sr->fix.mode)
+			sprintf(s, ", %.5f,%.5f", sr->fix.lat, sr->fix.lon);
+		else
+			sprintf(s, ", no GPS fix");
+		waddstr(w_aplst, s);
+	}
+	if (sr->defer.busy) {
+		waddstr(w_aplst, ", ");
+		sprintf(s, "scans deferred (%u kbit/s)", sr->defer.kbps);
+		wadd_attr_str(w_aplst, COLOR_PAIR(CP_YELLOW) | A_BOLD, s);
+	}
+	if (scan_log_dropped()) {
+		waddstr(w_aplst, ", ");
+		sprintf(s, "%zu scans not logged", scan_log_dropped());
+		wadd_attr_str(w_aplst, COLOR_PAIR(CP_RED) | A_BOLD, s);
+	}
+
+	if (*sf.expr) {
+		waddch(w_aplst, ' ');
+		wadd_attr_str(w_aplst, A_REVERSE, "filter:");
+		waddch(w_aplst, ' ');
+		waddstr(w_aplst, curtail(sf.expr, "~", 16));
+	}
 done:
-	pthread_mutex_unlock(&sr.mutex);
+	pthread_mutex_unlock(&sr->mutex);
 	wrefresh(w_aplst);
 }
 
-void scr_aplst_init(void)
+/* Read up to @len - 1 characters into @buf on the status line, prefixed by @label. */
+static void prompt_line(const char *label, char *buf, int len)
 {
-	static bool initialized = false;
+	mvwclrtoborder(w_aplst, MAXYLEN, 1);
+	wmove(w_aplst, MAXYLEN, 1);
+	wadd_attr_str(w_aplst, A_REVERSE, label);
+	waddch(w_aplst, ' ');
 
-	w_aplst = newwin_title(0, WAV_HEIGHT, "Scan window", false);
+	echo();
+	curs_set(1);
+	if (wgetnstr(w_aplst, buf, len - 1) != OK)
+		*buf = '\0';
+	curs_set(0);
+	noecho();
+}
 
-	/* Gathering scan data can take seconds. Inform user. */
-	mvwaddstr(w_aplst, 2, 1, "Waiting for scan data ...");
+/* Show @msg on the status line for %WARN_DISPLAY_DELAY seconds. */
+static void status_message(const char *msg, int attrs)
+{
+	mvwclrtoborder(w_aplst, MAXYLEN, 1);
+	wmove(w_aplst, MAXYLEN, 1);
+	wadd_attr_str(w_aplst, attrs, msg);
 	wrefresh(w_aplst);
+	sleep(WARN_DISPLAY_DELAY);
+}
+
+/* Read a filter expression on the status line, see scan_filter_set_expr(). */
+static void prompt_filter(void)
+{
+	char buf[sizeof(sf.expr)];
+	const char *err;
+
+	prompt_line("filter:", buf, sizeof(buf));
+
+	/* Applied right away on the cached snapshot, no rescan needed. */
+	err = scan_filter_set_expr(&sf, buf);
+	if (err)
+		status_message(err, COLOR_PAIR(CP_RED) | A_REVERSE);
+}
+
+/* Drop a named site-survey marker with the current scan snapshot. */
+static void drop_marker(void)
+{
+	char name[sizeof(((struct survey_marker *)0)->name)];
+
+	if (!site_survey_enabled()) {
+		status_message("Site survey requires the -S <file> option",
+			       COLOR_PAIR(CP_RED) | A_REVERSE);
+		return;
+	}
+	prompt_line("marker:", name, sizeof(name));
+	if (!*name)
+		return;
 
-	if (!initialized) {
-		pthread_mutexattr_t attr;
+	/* Only copies the snapshot, the survey file is written in the background. */
+	pthread_mutex_lock(&sr->mutex);
+	num_markers = site_survey_mark(name, sr);
+	pthread_mutex_unlock(&sr->mutex);
+	flash();
+}
+
+void scr_aplst_init(void)
+{
+	bool have_data;
 
-		pthread_mutexattr_init(&attr);
-		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
-		pthread_mutex_init(&sr.mutex, &attr);
-		initialized = true;
+	w_aplst = newwin_title(0, WAV_HEIGHT, "Scan window", false);
+
+	/* The last snapshot is shown right away, while the scan service resumes. */
+	sr = scan_service_start();
+	pthread_mutex_lock(&sr->mutex);
+	have_data = sr->head != NULL;
+	pthread_mutex_unlock(&sr->mutex);
+
+	if (!have_data) {
+		/* Gathering scan data can take seconds. Inform user. */
+		mvwaddstr(w_aplst, 2, 1, "Waiting for scan data ...");
+		wrefresh(w_aplst);
 	}
-	pthread_create(&scan_thread, NULL, do_scan, &sr);
 }
 
 int scr_aplst_loop(WINDOW *w_menu)
@@ -259,6 +974,70 @@ int scr_aplst_loop(WINDOW *w_menu)
 	case 'h':	/* Toggle inclusion of hidden ESSIDs */
 		conf.scan_hidden_essids = !conf.scan_hidden_essids;
 		return -1;
+	case '/':	/* Filter expression */
+		prompt_filter();
+		return -1;
+	/*
+	 * Grouping by ESSID
+	 */
+	case 'g':	/* Toggle group mode */
+		group_mode = !group_mode;
+		return -1;
+	case KEY_UP:
+		if (!group_mode)
+			list_move(-1);
+		else
+			group_move(-1);
+		return -1;
+	case KEY_DOWN:
+		if (!group_mode)
+			list_move(1);
+		else
+			group_move(1);
+		return -1;
+	/*
+	 * Scrolling
+	 */
+	case KEY_PPAGE:
+		if (!group_mode)
+			list_move(-list_height);
+		else
+			group_move(-group_height);
+		return -1;
+	case KEY_NPAGE:
+		if (!group_mode)
+			list_move(list_height);
+		else
+			group_move(group_height);
+		return -1;
+	case KEY_HOME:
+		list_cursor = 0;
+		group_cursor = 0;
+		return -1;
+	case KEY_END:
+		list_move(num_rows);
+		group_move(group_vis);
+		return -1;
+	case ' ':
+	case '\r':	/* Expand/collapse selected group */
+		if (group_mode && group_has_selection)
+			group_toggle_selected();
+		return -1;
+	case 'r':	/* Toggle roaming panel */
+		roam_mode = !roam_mode;
+		return -1;
+	case 'P':	/* Toggle channel-plan panel */
+		plan_mode = !plan_mode;
+		return -1;
+	case 'E':	/* Toggle events panel */
+		events_mode = !events_mode;
+		return -1;
+	case 'T':	/* Toggle scan-profile overlay */
+		prof_mode = !prof_mode;
+		return -1;
+	case 'M':	/* Site survey: drop a location marker */
+		drop_marker();
+		return -1;
 	/*
 	 * Sort Order
 	 */
@@ -299,8 +1078,10 @@ void scr_aplst_fini(void)
 {
 	/* Unlock mutex in case it was taken when scr_aplst_loop got interrupted by a SIGWINCH.
 	 * We are ignoring the error (EPERM) here if the main thread did not acquire the mutex. */
-	pthread_mutex_unlock(&sr.mutex);
-	pthread_cancel(scan_thread);
-	pthread_join(scan_thread, NULL);
+	pthread_mutex_unlock(&sr->mutex);
+	/* Also in case a SIGWINCH arrived while prompting for a filter. */
+	curs_set(0);
+	noecho();
+	scan_service_pause();
 	delwin(w_aplst);
 }
@@ -0,0 +1,178 @@
+/*
+ * New-BSSID detection: a persistent Bloom filter of the BSSIDs seen at this site.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * Every BSSID of every scan is looked up in, and added to, a Bloom filter, which
+ * is kept in the 'seen-bssids' file next to the configuration file. A BSSID not
+ * in the filter is new. The filter does not store the BSSIDs themselves, hence
+ * its size is fixed, at the price of a small rate of new BSSIDs being mistaken
+ * for known ones, which is set with the 'new_bss_miss_rate' option when the
+ * file is created. The BSSIDs of the first scan after that (all sweeps of a
+ * progressive scan) form the baseline, and are not reported.
+ *
+ * Like the BSS table, this is only used by the thread post-processing scans.
+ */
+#include "iw_scan.h"
+
+/* Number of BSSIDs that the filter is dimensioned for; beyond, it misses more. */
+#define SEEN_CAPACITY		100000
+
+/* Minimum interval between writes of the filter, in seconds. */
+#define SEEN_SAVE_INTERVAL	30
+
+#define SEEN_MAGIC		"wmseen1"
+
+/**
+ * struct seen_header - header of the 'seen-bssids' file, followed by the bits
+ * @magic:    %SEEN_MAGIC
+ * @nbits:    size of the bit array (a multiple of 8)
+ * @nhashes:  number of bits set per BSSID
+ * @count:    number of BSSIDs added so far
+ */
+struct seen_header {
+	char		magic[8];
+	uint32_t	nbits,
+			nhashes,
+			count;
+};
+
+static struct seen_header hdr;
+static uint8_t *bits;
+static bool baseline,		/* whether the current scan round is the first one */
+	    dirty;
+static time_t last_save;
+
+/* 64-bit FNV-1a, whose halves serve as the two hashes of double hashing. */
+static uint64_t hash_fnv1a_64(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint64_t hash = 14695981039346656037ull;
+
+	while (len--)
+		hash = (hash ^ *p++) * 1099511628211ull;
+	return hash;
+}
+
+/* Create an empty filter for %SEEN_CAPACITY BSSIDs at the configured miss rate. */
+static void seen_filter_create(void)
+{
+	const double p = conf.seen_miss / 1e3, n = SEEN_CAPACITY;
+
+	memcpy(hdr.magic, SEEN_MAGIC, sizeof(hdr.magic));
+	hdr.nbits   = (uint32_t)ceil(-n * log(p) / (M_LN2 * M_LN2) / 8) * 8;
+	hdr.nhashes = clamp(lround(hdr.nbits / n * M_LN2), 1, 32);
+	hdr.count   = 0;
+	bits = calloc(hdr.nbits / 8, 1);
+	if (!bits)
+		err_sys("unable to allocate BSSID filter");
+	baseline = true;
+}
+
+/* Load the filter from @path, returning false if there is no valid one. */
+static bool seen_filter_load(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	bool ok = false;
+
+	if (!fp)
+		return false;
+	if (fread(&hdr, sizeof(hdr), 1, fp) == 1 && !memcmp(hdr.magic, SEEN_MAGIC, sizeof(hdr.magic)) &&
+	    hdr.nbits && hdr.nbits % 8 == 0 && hdr.nhashes && hdr.nhashes <= 32) {
+		bits = malloc(hdr.nbits / 8);
+		if (!bits)
+			err_sys("unable to allocate BSSID filter");
+		ok = fread(bits, hdr.nbits / 8, 1, fp) == 1 && fgetc(fp) == EOF;
+		if (!ok) {
+			free(bits);
+			bits = NULL;
+		}
+	}
+	fclose(fp);
+	return ok;
+}
+
+/* Add @addr to the filter, returning true if it was not in it. */
+static bool seen_filter_add(const struct ether_addr *addr)
+{
+	const uint64_t h = hash_fnv1a_64(addr, sizeof(*addr));
+	const uint32_t h1 = h, h2 = h >> 32 | 1;
+	bool found = true;
+
+	if (!bits) {
+		char *path = conf_file_path("seen-bssids");
+
+		if (!seen_filter_load(path))
+			seen_filter_create();
+		free(path);
+	}
+
+	for (uint32_t i = 0; i < hdr.nhashes; i++) {
+		const uint32_t bit = (h1 + i * h2) % hdr.nbits;
+
+		if (!(bits[bit / 8] & 1 << bit % 8)) {
+			bits[bit / 8] |= 1 << bit % 8;
+			found = false;
+		}
+	}
+	if (found)
+		return false;
+	hdr.count++;
+	dirty = true;
+	return true;
+}
+
+/**
+ * Look up the BSSID of @e, adding it to the filter, and set @e->new_bss if it
+ * has first been seen during this run of wavemon (outside of the baseline).
+ * Returns true if @e has only now been found to be new.
+ */
+bool seen_filter_check(struct scan_entry *e)
+{
+	struct bss_record *rec = bss_table_get(&e->ap_addr);
+
+	if (seen_filter_add(&e->ap_addr) && !baseline) {
+		rec->new_bss = true;
+		e->new_bss   = true;
+		return true;
+	}
+	e->new_bss = rec->new_bss;
+	return false;
+}
+
+/**
+ * Conclude the checks of one scan round, writing the filter if it has changed
+ * and the last write is at least %SEEN_SAVE_INTERVAL ago, or if @force is set.
+ * Returns false if the filter could not be written.
+ */
+bool seen_filter_sync(bool force)
+{
+	char *path, *tmp;
+	FILE *fp;
+	bool ok;
+	int cancel_state;
+
+	baseline = false;
+	if (!dirty || (!force && time(NULL) - last_save < SEEN_SAVE_INTERVAL))
+		return true;
+
+	/* Write a new file and rename it, so that an interrupted write leaves the old one. */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+	path = conf_file_path("seen-bssids");
+	tmp  = a_sprintf("%s.tmp", path);
+	fp   = fopen(tmp, "w");
+	ok   = fp != NULL;
+	if (fp) {
+		ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+		     fwrite(bits, hdr.nbits / 8, 1, fp) == 1;
+		ok = !fclose(fp) && ok && !rename(tmp, path);
+		if (!ok)
+			unlink(tmp);
+	}
+	/* On failure, carry on without persistence, retrying at the next interval. */
+	last_save = time(NULL);
+	dirty     = !ok;
+	free(tmp);
+	free(path);
+	pthread_setcancelstate(cancel_state, NULL);
+	return ok;
+}
@@ -0,0 +1,281 @@
+/*
+ * Site survey: named location markers, with the readings taken there.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * Markers are appended to the survey file by a writer thread, so that the UI
+ * does not block on I/O. The file is line-oriented text. Strings and BSSes are
+ * written once and later referred to by their index (counting from 0 at each
+ * 'V' line), and signal levels are stored as difference to the last recorded
+ * level of the same BSS:
+ *
+ *   V <version> <interface>	start of a session, resets all indices
+ *   M <unix time> <name>	location marker
+ *   L <bssid> <dBm> <bitrate>	link sample ('L -' if not associated)
+ *   E <essid>			next ESSID index
+ *   B <bssid> <essid> <freq>	next BSS index (BSSID, ESSID index, MHz)
+ *   S <gap><delta> ...		signal readings: index gap to the previous
+ *				reading (first: index + 1), signed dB delta
+ */
+#include "iw_scan.h"
+#include "iw_nl80211.h"
+
+#define SURVEY_FORMAT_VERSION	1
+
+/**
+ * struct intern_table - hash table assigning consecutive indices to keys
+ * @ent:      entries, in order of insertion
+ * @num:      number of entries
+ * @cap:      allocated length of @ent
+ * @buckets:  index + 1 of the first entry in each hash bucket (0 if empty)
+ * @nbuckets: length of @buckets (power of 2)
+ */
+struct intern_table {
+	struct intern_entry {
+		void		*key;
+		size_t		len;
+		uint32_t	hnext;
+		int8_t		last;	/* last recorded signal level */
+	}		*ent;
+	size_t		num,
+			cap;
+	uint32_t	*buckets;
+	size_t		nbuckets;
+};
+
+static void intern_rehash(struct intern_table *t, size_t nbuckets)
+{
+	free(t->buckets);
+	t->buckets  = calloc(nbuckets, sizeof(*t->buckets));
+	t->nbuckets = nbuckets;
+	if (!t->buckets)
+		err_sys("unable to allocate survey index");
+
+	for (size_t i = 0; i < t->num; i++) {
+		uint32_t *b = &t->buckets[hash_fnv1a(t->ent[i].key, t->ent[i].len) & (nbuckets - 1)];
+
+		t->ent[i].hnext = *b;
+		*b = i + 1;
+	}
+}
+
+/** Return the index of @key in @t, adding it if new (which sets @added). */
+static size_t intern(struct intern_table *t, const void *key, size_t len, bool *added)
+{
+	uint32_t idx, *b;
+
+	*added = false;
+	if (t->nbuckets) {
+		b = &t->buckets[hash_fnv1a(key, len) & (t->nbuckets - 1)];
+		for (idx = *b; idx; idx = t->ent[idx - 1].hnext)
+			if (t->ent[idx - 1].len == len && !memcmp(t->ent[idx - 1].key, key, len))
+				return idx - 1;
+	}
+
+	if (t->num == t->cap) {
+		t->cap = t->cap ? 2 * t->cap : 256;
+		t->ent = realloc(t->ent, t->cap * sizeof(*t->ent));
+		if (!t->ent)
+			err_sys("unable to allocate survey index");
+	}
+	t->ent[t->num].key  = malloc(len);
+	if (!t->ent[t->num].key)
+		err_sys("unable to allocate survey index");
+	memcpy(t->ent[t->num].key, key, len);
+	t->ent[t->num].len  = len;
+	t->ent[t->num].last = 0;
+	t->num++;
+
+	/* Keep the load factor below 1. */
+	if (t->num > t->nbuckets / 2)
+		intern_rehash(t, roundup_pow2(4 * t->num));
+	else {
+		b = &t->buckets[hash_fnv1a(key, len) & (t->nbuckets - 1)];
+		t->ent[t->num - 1].hnext = *b;
+		*b = t->num;
+	}
+	*added = true;
+	return t->num - 1;
+}
+
+/*
+ * Writer thread and its queue
+ */
+static FILE *survey_fp;
+static pthread_t writer_thread;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct survey_marker *queue_head, **queue_tail = &queue_head;
+static bool writer_stop;
+static size_t num_markers;
+
+/* Only used by the writer thread. */
+static struct intern_table essids, bsses;
+
+/* Compact (separator-less) representation of a MAC address. */
+static const char *hex_addr(const struct ether_addr *ea)
+{
+	static char buf[2 * ETH_ALEN + 1];
+
+	for (int i = 0; i < ETH_ALEN; i++)
+		sprintf(buf + 2 * i, "%02x", ea->ether_addr_octet[i]);
+	return buf;
+}
+
+/* For quick-sorting readings in order of BSS index. */
+static int cmp_reading(const void *a, const void *b)
+{
+	return (*(const size_t *)a > *(const size_t *)b) - (*(const size_t *)a < *(const size_t *)b);
+}
+
+static void write_marker(const struct survey_marker *m)
+{
+	/* Key identifying a BSS: BSSID, ESSID index, and frequency. */
+	uint8_t key[ETH_ALEN + 2 * sizeof(uint32_t)];
+	size_t *readings, prev = 0;
+	bool added;
+
+	fprintf(survey_fp, "M %lld %s\n", (long long)m->time, m->name);
+	if (ether_addr_is_zero(&m->link.bssid))
+		fprintf(survey_fp, "L -\n");
+	else
+		fprintf(survey_fp, "L %s %d %s\n", hex_addr(&m->link.bssid),
+			m->link.signal, *m->link.tx_bitrate ? m->link.tx_bitrate : "-");
+
+	readings = calloc(m->num_bss, 2 * sizeof(*readings));
+	if (m->num_bss && !readings)
+		err_sys("unable to allocate survey readings");
+
+	for (size_t i = 0; i < m->num_bss; i++) {
+		const struct survey_bss *bss = m->bss + i;
+		uint32_t essid_idx, freq = bss->freq;
+
+		essid_idx = intern(&essids, bss->essid, strlen(bss->essid), &added);
+		if (added)
+			fprintf(survey_fp, "E %s\n", bss->essid);
+
+		memcpy(key, &bss->addr, ETH_ALEN);
+		memcpy(key + ETH_ALEN, &essid_idx, sizeof(essid_idx));
+		memcpy(key + ETH_ALEN + sizeof(essid_idx), &freq, sizeof(freq));
+		readings[2 * i] = intern(&bsses, key, sizeof(key), &added);
+		readings[2 * i + 1] = i;
+		if (added)
+			fprintf(survey_fp, "B %s %u %u\n", hex_addr(&bss->addr), essid_idx, freq);
+	}
+
+	/* Sorted by index, so that the gaps stay small and non-negative. */
+	qsort(readings, m->num_bss, 2 * sizeof(*readings), cmp_reading);
+	fputc('S', survey_fp);
+	for (size_t i = 0; i < m->num_bss; i++) {
+		struct intern_entry *ent = bsses.ent + readings[2 * i];
+		const int8_t signal = m->bss[readings[2 * i + 1]].signal;
+
+		fprintf(survey_fp, " %zu%+d", readings[2 * i] + 1 - prev, signal - ent->last);
+		ent->last = signal;
+		prev = readings[2 * i] + 1;
+	}
+	fputc('\n', survey_fp);
+	free(readings);
+}
+
+static void *survey_writer(void *arg)
+{
+	struct survey_marker *m;
+
+	(void)arg;
+	pthread_mutex_lock(&queue_mutex);
+	for (;;) {
+		while (!queue_head && !writer_stop)
+			pthread_cond_wait(&queue_cond, &queue_mutex);
+		if (!queue_head)
+			break;
+
+		m = queue_head;
+		queue_head = m->next;
+		if (!queue_head)
+			queue_tail = &queue_head;
+
+		/* Write without holding the lock, so that the UI can continue to queue. */
+		pthread_mutex_unlock(&queue_mutex);
+		write_marker(m);
+		if (fflush(survey_fp))
+			err_sys("can not write survey file");
+		free(m);
+		pthread_mutex_lock(&queue_mutex);
+	}
+	pthread_mutex_unlock(&queue_mutex);
+	return NULL;
+}
+
+/* Write pending markers on exit. */
+static void site_survey_fini(void)
+{
+	pthread_mutex_lock(&queue_mutex);
+	writer_stop = true;
+	pthread_cond_signal(&queue_cond);
+	pthread_mutex_unlock(&queue_mutex);
+
+	pthread_join(writer_thread, NULL);
+	fclose(survey_fp);
+}
+
+/** Open the survey file at @path for appending, and start the writer. */
+void site_survey_init(const char *path)
+{
+	sigset_t blockmask, oldmask;
+
+	survey_fp = fopen(path, "a");
+	if (!survey_fp)
+		err_sys("can not open survey file %s", path);
+	fprintf(survey_fp, "V %d %s\n", SURVEY_FORMAT_VERSION, conf_ifname());
+
+	/* SIGWINCH is supposed to be handled in the main thread. */
+	sigemptyset(&blockmask);
+	sigaddset(&blockmask, SIGWINCH);
+	pthread_sigmask(SIG_BLOCK, &blockmask, &oldmask);
+	pthread_create(&writer_thread, NULL, survey_writer, NULL);
+	pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+
+	atexit(site_survey_fini);
+}
+
+bool site_survey_enabled(void)
+{
+	return survey_fp != NULL;
+}
+
+/**
+ * Queue a marker named @name, with the latest link sample and the scan snapshot
+ * of @sr (whose mutex must be held). Returns the number of markers so far.
+ */
+size_t site_survey_mark(const char *name, const struct scan_result *sr)
+{
+	struct iw_nl80211_linkstat ls;
+	struct survey_marker *m;
+	struct scan_entry *cur;
+	size_t n = 0;
+
+	m = calloc(1, sizeof(*m) + sr->num.entries * sizeof(m->bss[0]));
+	if (!m)
+		err_sys("unable to allocate survey marker");
+
+	m->time = time(NULL);
+	snprintf(m->name, sizeof(m->name), "%s", name);
+	/* The link sample of @sr dates from the start of the last scan. */
+	sampling_get(&ls, 0, NULL);
+	link_sample_set(&m->link, &ls);
+	for (cur = sr->head; cur && n < sr->num.entries; cur = cur->next, n++) {
+		m->bss[n].addr   = cur->ap_addr;
+		m->bss[n].freq   = cur->freq;
+		m->bss[n].signal = cur->bss_signal;
+		memcpy(m->bss[n].essid, cur->essid, sizeof(m->bss[n].essid));
+	}
+	m->num_bss = n;
+
+	pthread_mutex_lock(&queue_mutex);
+	*queue_tail = m;
+	queue_tail  = &m->next;
+	pthread_cond_signal(&queue_cond);
+	pthread_mutex_unlock(&queue_mutex);
+
+	return ++num_markers;
+}
@@ -17,7 +17,7 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
-#include "wavemon.h"
+#include "iw_if.h"
 #include <locale.h>
 #include <setjmp.h>
 
@@ -59,8 +59,12 @@ static const struct {
 		.loop	  = scr_aplst_loop,
 		.fini	  = scr_aplst_fini
 	},
-	[SCR_EMPTY_F4]	= {
-		.key_name = "",
+	[SCR_CHIST]	= {
+		.key_name = "chist",
+		.shortcut = 'c',
+		.init	  = scr_chist_init,
+		.loop	  = scr_chist_loop,
+		.fini	  = scr_chist_fini
 	},
 	[SCR_EMPTY_F5]	= {
 		.key_name = "",
@@ -201,6 +205,9 @@ int main(int argc, char *argv[])
 	sigemptyset(&blockmask);
 	sigaddset(&blockmask, SIGWINCH);
 
+	/* Runs independently of the screens, so that switching does not interrupt sampling. */
+	sampling_init();
+
 	for (cur = conf.startup_scr; cur != SCR_QUIT; cur = next) {
 		WINDOW *w_menu;
 		volatile int escape = 0;
@@ -107,6 +107,12 @@ enum scan_filter_band {
 	SCAN_FILTER_BAND_5G
 };
 
+/** Interfaces that the scan window scans on */
+enum scan_radios {
+	SCAN_RADIOS_CURRENT,	/* only the interface selected by @if_idx */
+	SCAN_RADIOS_ALL		/* in addition, one interface of each other PHY */
+};
+
 /*
  * Global in-memory representation of current wavemon configuration state
  */
@@ -125,17 +131,24 @@ extern struct wavemon_conf {
 	int	slotsize,
 		meter_decay;
 
+	int	bss_mem,		/* BSS table memory limit, in MiB */
+		seen_miss,		/* new-BSSID miss rate, in 1/1000 */
+		scan_defer,		/* link traffic that defers scans, in kbit/s (0: off) */
+		scan_bg_iv;		/* scan interval while the scan screens are not shown, in s (0: off) */
+
 	/* Boolean values */
 	int	check_geometry,		/* Ensure window is large enough */
 		cisco_mac,		/* Cisco-style MAC addresses */
 		transparent_bg,		/* Use terminal background instead of black */
 		override_bounds,	/* Override autodetection */
 		scan_sort_asc,		/* Direction of @scan_sort_order */
-		scan_hidden_essids;	/* Whether to include hidden SSIDs */
+		scan_hidden_essids,	/* Whether to include hidden SSIDs */
+		scan_progressive;	/* Whether to scan one band at a time */
 
 	/* Enumerated values */
 	int	scan_sort_order,	/* channel|signal|open|chan/sig ... */
 		scan_filter_band,	/* 2.4ghz|5ghz|both */
+		scan_radios,		/* current|all */
 		lthreshold_action,	/* disabled|beep|flash|beep+flash */
 		hthreshold_action,	/* disabled|beep|flash|beep+flash */
 		startup_scr;		/* info|history|aplist */
@@ -145,6 +158,7 @@ extern struct wavemon_conf {
  * Initialisation & Configuration
  */
 extern void getconf(int argc, char *argv[]);
+extern char *conf_file_path(const char *name);
 
 /* Configuration items to manipulate the current configuration */
 struct conf_item {
@@ -181,7 +195,7 @@ enum wavemon_screen {
 	SCR_INFO,	/* F1 */
 	SCR_LHIST,	/* F2 */
 	SCR_SCAN,	/* F3 */
-	SCR_EMPTY_F4,	/* placeholder */
+	SCR_CHIST,	/* F4 */
 	SCR_EMPTY_F5,	/* placeholder */
 	SCR_EMPTY_F6,	/* placeholder */
 	SCR_PREFS,	/* F7 */
@@ -202,6 +216,10 @@ extern void scr_aplst_init(void);
 extern int  scr_aplst_loop(WINDOW *w_menu);
 extern void scr_aplst_fini(void);
 
+extern void scr_chist_init(void);
+extern int  scr_chist_loop(WINDOW *w_menu);
+extern void scr_chist_fini(void);
+
 extern void scr_conf_init(void);
 extern int  scr_conf_loop(WINDOW *w_menu);
 extern void scr_conf_fini(void);
@@ -321,7 +339,7 @@ static inline void str_tolower(char *s)
 }
 
 /* Check if @str is printable (compare iw_essid_escape()) */
-static inline bool str_is_ascii(char *s)
+static inline bool str_is_ascii(const char *s)
 {
 	if (!s || !*s)
 		return false;
@@ -331,6 +349,27 @@ static inline bool str_is_ascii(char *s)
 	return true;
 }
 
+/* 32-bit FNV-1a hash of @len bytes at @data. */
+static inline uint32_t hash_fnv1a(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint32_t hash = 2166136261u;
+
+	while (len--)
+		hash = (hash ^ *p++) * 16777619u;
+	return hash;
+}
+
+/* Smallest power of 2 that is >= @n (and at least 1). */
+static inline size_t roundup_pow2(size_t n)
+{
+	size_t p = 1;
+
+	while (p < n)
+		p <<= 1;
+	return p;
+}
+
 /* number of digits needed to display integer part of @val */
 static inline int num_int_digits(const double val)
 {